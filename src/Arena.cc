@@ -0,0 +1,75 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Arena.hh"
+
+const size_t Arena::maxAlign;
+
+Arena::Arena(size_t chunk_size)
+    : m_chunk_size(chunk_size), m_current(0), m_used(0), m_total(0)
+{ }
+
+Arena::~Arena()
+{
+    reset();
+    for (uint8_t* chunk : m_chunks)
+        delete[] chunk;
+}
+
+static uintptr_t alignUp(uintptr_t p, size_t align)
+{
+    return (p + align - 1) & ~(uintptr_t(align) - 1);
+}
+
+void* Arena::allocate(size_t size, size_t align)
+{
+    m_total += size;
+    if (size > m_chunk_size) {
+        m_large.push_back(new uint8_t[size + align]);
+        return reinterpret_cast<void*>(
+                alignUp(reinterpret_cast<uintptr_t>(m_large.back()), align));
+    }
+
+    for (;;) {
+        if (m_current == m_chunks.size())
+            m_chunks.push_back(new uint8_t[m_chunk_size + maxAlign]);
+
+        uintptr_t base = reinterpret_cast<uintptr_t>(m_chunks[m_current]);
+        uintptr_t p = alignUp(base + m_used, align);
+        if (p + size <= base + m_chunk_size + maxAlign) {
+            m_used = p + size - base;
+            return reinterpret_cast<void*>(p);
+        }
+        ++m_current;
+        m_used = 0;
+    }
+}
+
+void Arena::reset()
+{
+    for (auto it = m_dtors.rbegin(); it != m_dtors.rend(); ++it)
+        it->fn(it->obj);
+    m_dtors.clear();
+
+    for (uint8_t* chunk : m_large)
+        delete[] chunk;
+    m_large.clear();
+
+    m_current = 0;
+    m_used = 0;
+    m_total = 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Bump-pointer allocator for objects living while one message is
+ * processed. reset() destroys them in the reverse order and rewinds
+ * the arena keeping its chunks, so in the steady state processing
+ * of a message doesn't touch the heap.
+ */
+class Arena {
+public:
+    explicit Arena(size_t chunk_size = 16 * 1024);
+    ~Arena();
+
+    void* allocate(size_t size, size_t align = maxAlign);
+
+    /// Constructs an object destroyed by reset()
+    template<class T, class... Args>
+    T* make(Args&&... args)
+    {
+        T* ret = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (not std::is_trivially_destructible<T>::value)
+            m_dtors.push_back(Dtor{ret, &destroy<T>});
+        return ret;
+    }
+
+    /// Destroys all objects and makes the memory available again
+    void reset();
+
+    /// Bytes allocated since the last reset
+    size_t used() const { return m_total; }
+
+private:
+    static const size_t maxAlign = 16;
+
+    struct Dtor {
+        void* obj;
+        void (*fn)(void*);
+    };
+
+    template<class T>
+    static void destroy(void* obj) { static_cast<T*>(obj)->~T(); }
+
+    size_t m_chunk_size;
+    std::vector<uint8_t*> m_chunks;
+    // Allocations larger than a chunk, freed by reset()
+    std::vector<uint8_t*> m_large;
+    std::vector<Dtor> m_dtors;
+    size_t m_current;
+    size_t m_used;
+    size_t m_total;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+};
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CompactTLV.hh"
+
+#include <cstring>
+#include <fluid/util/util.h>
+
+#include "PortRange.hh"
+
+static const size_t headerLength = 4;
+
+CompactTLV::CompactTLV()
+    : field(0), masked(false), length(0)
+{ }
+
+CompactTLV::CompactTLV(const of13::OXMTLV* tlv)
+    : field(tlv->field()), masked(tlv->has_mask()), length(tlv->length())
+{
+    CHECK_LE(length, maxPayload) << "OXM field " << int(field) << " is too long";
+
+    uint8_t buffer[headerLength + maxPayload];
+    // pack() doesn't modify the object but isn't declared const
+    const_cast<of13::OXMTLV*>(tlv)->pack(buffer);
+    memcpy(data, buffer + headerLength, length);
+}
+
+of13::OXMTLV* CompactTLV::makeTLV() const
+{
+    uint16_t half = length / 2;
+
+    // Masked L4 ports aren't a part of OpenFlow 1.3
+    switch (field) {
+    case of13::OFPXMT_OFB_TCP_SRC:
+    case of13::OFPXMT_OFB_TCP_DST:
+    case of13::OFPXMT_OFB_UDP_SRC:
+    case of13::OFPXMT_OFB_UDP_DST:
+        if (masked) {
+            return new MaskedPort(field, (data[0] << 8) | data[1],
+                                  (data[half] << 8) | data[half + 1]);
+        }
+        break;
+    default:
+        break;
+    }
+
+    uint8_t buffer[headerLength + maxPayload];
+    uint32_t header = hton32(of13::OXMTLV::make_header(of13::OFPXMC_OPENFLOW_BASIC,
+                                                       field, masked, length));
+    memcpy(buffer, &header, headerLength);
+    memcpy(buffer + headerLength, data, length);
+
+    of13::OXMTLV* ret = of13::Match::make_oxm_tlv(field);
+    CHECK(ret) << "Unsupported OXM field " << int(field);
+    ret->unpack(buffer);
+    return ret;
+}
+
+bool CompactTLV::match(const CompactTLV& value) const
+{
+    if (value.field != field)
+        return false;
+    if (not masked)
+        return value.length == length && memcmp(value.data, data, length) == 0;
+
+    uint8_t half = length / 2;
+    if (value.length < half)
+        return false;
+    for (uint8_t i = 0; i < half; ++i) {
+        if ((value.data[i] ^ data[i]) & data[half + i])
+            return false;
+    }
+    return true;
+}
+
+bool CompactTLV::match(of13::OXMTLV* value) const
+{
+    return value->field() == field && match(CompactTLV(value));
+}
+
+std::string CompactTLV::key() const
+{
+    std::string ret(3 + length, '\0');
+    ret[0] = field;
+    ret[1] = masked;
+    ret[2] = length;
+    memcpy(&ret[3], data, length);
+    return ret;
+}
+
+bool CompactTLV::operator==(const CompactTLV& other) const
+{
+    return field == other.field && masked == other.masked &&
+           length == other.length && memcmp(data, other.data, length) == 0;
+}
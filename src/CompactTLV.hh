@@ -0,0 +1,54 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Common.hh"
+
+#include <string>
+
+/**
+ * OXM value stored inline: field id and the packed payload, i.e. value
+ * followed by the mask. Large structures keep these instead of cloned
+ * polymorphic of13::OXMTLV objects and convert them back to OXM only
+ * when emitting flow-mods.
+ */
+struct CompactTLV {
+    // Masked IPv6 address, the longest OpenFlow 1.3 basic field
+    static const size_t maxPayload = 32;
+
+    uint8_t field;
+    bool masked;
+    // Payload size in bytes
+    uint8_t length;
+    uint8_t data[maxPayload];
+
+    CompactTLV();
+    explicit CompactTLV(const of13::OXMTLV* tlv);
+
+    /// New OXMTLV object owned by the caller
+    of13::OXMTLV* makeTLV() const;
+
+    /// Checks unmasked value read from the packet
+    bool match(of13::OXMTLV* value) const;
+    bool match(const CompactTLV& value) const;
+
+    /// Bytes identifying the value, equal for equal values only
+    std::string key() const;
+
+    bool operator==(const CompactTLV& other) const;
+    bool operator!=(const CompactTLV& other) const { return not (*this == other); }
+};
@@ -0,0 +1,316 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CompiledTraceTree.hh"
+
+#include <algorithm>
+
+#include "Packet.hh"
+#include "Match.hh"
+#include "OXMTLVUnion.hh"
+#include "PortRange.hh"
+
+CompiledTraceTree::CompiledTraceTree()
+    : m_valid(false), m_nslots(0)
+{
+    std::fill(m_slot, m_slot + 256, noSlot);
+}
+
+void CompiledTraceTree::invalidate()
+{
+    m_valid = false;
+    m_code.clear();
+    m_loads.clear();
+    m_prefixes.clear();
+    m_free_code.clear();
+    m_free_loads.clear();
+    m_free_prefixes.clear();
+}
+
+TraceTreeNode::LeafData* CompiledTraceTree::find(TraceTreeNode* root, Packet* pkt)
+{
+    if (not m_valid)
+        compile(root);
+
+    OXMTLVUnion cache[maxSlots];
+    OXMTLVUnion tmp;
+
+    auto read = [&](uint8_t field) -> of13::OXMTLV* {
+        uint8_t slot = m_slot[field];
+        OXMTLVUnion& data = (slot == noSlot) ? tmp : cache[slot];
+        if (slot == noSlot || data.base() == nullptr) {
+            data.init(field);
+            pkt->read(data);
+        }
+        return data.base();
+    };
+
+    uint32_t pc = 0;
+    for (;;) {
+        const Instr& in = m_code[pc];
+
+        switch (in.op) {
+        case Miss:
+            return nullptr;
+        case Leaf:
+            // Outdated leaf is removed by the next change of the tree
+            if (in.leaf->liveType() != TraceTreeNode::Leaf)
+                return nullptr;
+            return in.leaf->leaf;
+        case Test:
+            pc = in.test.value->match(read(in.field)) ?
+                    in.test.positive : in.test.negative;
+            break;
+        case Load: {
+            const LoadTable& table = m_loads[in.load];
+            CompactTLV data(read(in.field));
+
+            if (not table.masked) {
+                auto it = table.index.find(data.key());
+                if (it == table.index.end())
+                    return nullptr;
+                pc = it->second;
+                break;
+            }
+
+            auto it = std::find_if(table.branches.begin(), table.branches.end(),
+                    [&data](const std::pair<CompactTLV, uint32_t>& b) {
+                        return b.first.match(data);
+                    });
+            if (it == table.branches.end())
+                return nullptr;
+            pc = it->second;
+            break;
+        }
+        case Range: {
+            uint16_t port = portValue(read(in.field));
+            pc = (in.range.lo <= port && port <= in.range.hi) ?
+                    in.range.positive : in.range.negative;
+            break;
+        }
+        case Prefix: {
+            const PrefixTable& table = m_prefixes[in.prefix];
+            pc = table.children[table.set->lookup(read(in.field)) + 1];
+            break;
+        }
+        }
+    }
+}
+
+void CompiledTraceTree::update(TraceTreeNode* t)
+{
+    if (not m_valid)
+        return;
+    compileNode(t, t->m_compiled);
+}
+
+void CompiledTraceTree::addBranch(TraceTreeNode* load, const CompactTLV& value,
+                                  TraceTreeNode* child)
+{
+    if (not m_valid)
+        return;
+    compileBranch(m_code[load->m_compiled].load, value, child);
+}
+
+void CompiledTraceTree::pruneNode(TraceTreeNode* t)
+{
+    if (not m_valid || t->m_compiled == TraceTreeNode::notCompiled)
+        return;
+
+    // Children are empty, so each of them has one instruction
+    Instr& in = m_code[t->m_compiled];
+    switch (in.op) {
+    case Test:
+        m_free_code.push_back(in.test.negative);
+        m_free_code.push_back(in.test.positive);
+        break;
+    case Range:
+        m_free_code.push_back(in.range.negative);
+        m_free_code.push_back(in.range.positive);
+        break;
+    case Load:
+        for (auto& branch : m_loads[in.load].branches)
+            m_free_code.push_back(branch.second);
+        m_loads[in.load] = LoadTable();
+        m_free_loads.push_back(in.load);
+        break;
+    case Prefix:
+        for (uint32_t child : m_prefixes[in.prefix].children)
+            m_free_code.push_back(child);
+        m_prefixes[in.prefix] = PrefixTable();
+        m_free_prefixes.push_back(in.prefix);
+        break;
+    default:
+        break;
+    }
+    in.op = Miss;
+}
+
+void CompiledTraceTree::pruneBranch(TraceTreeNode* load, const CompactTLV& value)
+{
+    if (not m_valid || load->m_compiled == TraceTreeNode::notCompiled)
+        return;
+
+    LoadTable& table = m_loads[m_code[load->m_compiled].load];
+    auto it = std::find_if(table.branches.begin(), table.branches.end(),
+            [&value](const std::pair<CompactTLV, uint32_t>& b) {
+                return b.first == value;
+            });
+    if (it == table.branches.end())
+        return;
+    m_free_code.push_back(it->second);
+    table.branches.erase(it);
+    table.index.erase(value.key());
+}
+
+void CompiledTraceTree::compile(TraceTreeNode* root)
+{
+    DVLOG(10) << "Compiling trace tree";
+
+    invalidate();
+    std::fill(m_slot, m_slot + 256, noSlot);
+    m_nslots = 0;
+
+    compileNode(root, alloc());
+    m_valid = true;
+}
+
+uint32_t CompiledTraceTree::alloc()
+{
+    if (not m_free_code.empty()) {
+        uint32_t pc = m_free_code.back();
+        m_free_code.pop_back();
+        m_code[pc].op = Miss;
+        return pc;
+    }
+    m_code.emplace_back();
+    m_code.back().op = Miss;
+    return m_code.size() - 1;
+}
+
+uint32_t CompiledTraceTree::allocLoad()
+{
+    if (not m_free_loads.empty()) {
+        uint32_t ret = m_free_loads.back();
+        m_free_loads.pop_back();
+        return ret;
+    }
+    m_loads.emplace_back();
+    return m_loads.size() - 1;
+}
+
+uint32_t CompiledTraceTree::allocPrefix()
+{
+    if (not m_free_prefixes.empty()) {
+        uint32_t ret = m_free_prefixes.back();
+        m_free_prefixes.pop_back();
+        return ret;
+    }
+    m_prefixes.emplace_back();
+    return m_prefixes.size() - 1;
+}
+
+void CompiledTraceTree::allocSlot(uint8_t field)
+{
+    if (m_slot[field] == noSlot && m_nslots < maxSlots)
+        m_slot[field] = m_nslots++;
+}
+
+void CompiledTraceTree::compileNode(TraceTreeNode* t, uint32_t pc)
+{
+    t->m_compiled = pc;
+
+    // m_code may be reallocated, so fill a copy first
+    Instr in;
+    in.op = Miss;
+
+    switch (t->type()) {
+    case TraceTreeNode::Empty:
+        m_code[pc] = in;
+        break;
+    case TraceTreeNode::Leaf:
+        in.op = Leaf;
+        in.leaf = t;
+        m_code[pc] = in;
+        break;
+    case TraceTreeNode::Test:
+        in.op = Test;
+        in.field = t->test.value.field;
+        in.test.value = &t->test.value;
+        in.test.negative = alloc();
+        in.test.positive = alloc();
+        allocSlot(in.field);
+        m_code[pc] = in;
+
+        compileNode(t->test.negativeChild, in.test.negative);
+        compileNode(t->test.positiveChild, in.test.positive);
+        break;
+    case TraceTreeNode::Load:
+        in.op = Load;
+        in.field = t->load.value.field;
+        in.load = allocLoad();
+        allocSlot(in.field);
+        m_code[pc] = in;
+
+        m_loads[in.load].masked = false;
+        for (TraceTreeNode::LoadData* l = &t->load; l != nullptr; l = l->next)
+            compileBranch(in.load, l->value, l->child);
+        break;
+    case TraceTreeNode::Range:
+        in.op = Range;
+        in.field = t->range.field;
+        in.range.lo = t->range.lo;
+        in.range.hi = t->range.hi;
+        in.range.negative = alloc();
+        in.range.positive = alloc();
+        allocSlot(in.field);
+        m_code[pc] = in;
+
+        compileNode(t->range.negativeChild, in.range.negative);
+        compileNode(t->range.positiveChild, in.range.positive);
+        break;
+    case TraceTreeNode::Prefix: {
+        in.op = Prefix;
+        in.field = t->prefix.set->field();
+        in.prefix = allocPrefix();
+        allocSlot(in.field);
+        m_code[pc] = in;
+
+        PrefixTable table;
+        table.set = t->prefix.set;
+        for (size_t i = 0; i <= table.set->size(); ++i)
+            table.children.push_back(alloc());
+        m_prefixes[in.prefix] = table;
+
+        for (size_t i = 0; i <= table.set->size(); ++i)
+            compileNode(t->prefix.children[i], table.children[i]);
+        break;
+    }
+    }
+}
+
+void CompiledTraceTree::compileBranch(uint32_t load, const CompactTLV& value,
+                                      TraceTreeNode* child)
+{
+    uint32_t pc = alloc();
+    LoadTable& table = m_loads[load];
+
+    table.branches.emplace_back(value, pc);
+    table.index.emplace(value.key(), pc);
+    table.masked |= value.masked;
+
+    compileNode(child, pc);
+}
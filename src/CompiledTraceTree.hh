@@ -0,0 +1,126 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Common.hh"
+#include "TraceTree.hh"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Packet;
+
+/**
+ * Trace tree flattened into a contiguous array of instructions.
+ * Every node of the tree occupies one instruction at position
+ * TraceTreeNode::m_compiled, so augment() patches it in place instead
+ * of recompiling the whole tree. Leaves refer to the tree nodes.
+ * Instructions and tables of pruned subtrees are reused by new nodes.
+ */
+class CompiledTraceTree {
+public:
+    CompiledTraceTree();
+
+    /// Compiles the tree if necessary and looks up a leaf for the packet
+    TraceTreeNode::LeafData* find(TraceTreeNode* root, Packet* pkt);
+
+    /// Recompiles the subtree of a node that was empty before
+    void update(TraceTreeNode* t);
+
+    /// Registers a new branch of the Load node
+    void addBranch(TraceTreeNode* load, const CompactTLV& value, TraceTreeNode* child);
+
+    /// Frees instructions of the empty children of a node being pruned
+    void pruneNode(TraceTreeNode* t);
+    /// Frees the empty branch being removed from the Load node
+    void pruneBranch(TraceTreeNode* load, const CompactTLV& value);
+
+    /// Drops compiled form; it will be compiled on the next lookup
+    void invalidate();
+    bool valid() const { return m_valid; }
+
+private:
+    enum Op : uint8_t {
+        Miss,
+        Leaf,
+        Test,
+        Load,
+        Prefix,
+        Range
+    };
+
+    struct TestInstr {
+        const CompactTLV* value;
+        uint32_t negative;
+        uint32_t positive;
+    };
+
+    struct RangeInstr {
+        uint16_t lo;
+        uint16_t hi;
+        uint32_t negative;
+        uint32_t positive;
+    };
+
+    struct Instr {
+        Op op;
+        uint8_t field;
+        union {
+            TestInstr test;
+            RangeInstr range;
+            uint32_t load;
+            uint32_t prefix;
+            TraceTreeNode* leaf;
+        };
+    };
+
+    struct LoadTable {
+        std::vector<std::pair<CompactTLV, uint32_t>> branches;
+        std::unordered_map<std::string, uint32_t> index;
+        bool masked;
+    };
+
+    struct PrefixTable {
+        const PrefixSet* set;
+        // Positions of the node children
+        std::vector<uint32_t> children;
+    };
+
+    // Fields read more than once per lookup are cached in slots
+    static const uint8_t maxSlots = 16;
+    static const uint8_t noSlot = 0xff;
+
+    bool m_valid;
+    std::vector<Instr> m_code;
+    std::vector<LoadTable> m_loads;
+    std::vector<PrefixTable> m_prefixes;
+    // Positions freed by pruning
+    std::vector<uint32_t> m_free_code;
+    std::vector<uint32_t> m_free_loads;
+    std::vector<uint32_t> m_free_prefixes;
+    uint8_t m_slot[256];
+    uint8_t m_nslots;
+
+    void compile(TraceTreeNode* root);
+    void compileNode(TraceTreeNode* t, uint32_t pc);
+    void compileBranch(uint32_t load, const CompactTLV& value, TraceTreeNode* child);
+    uint32_t alloc();
+    uint32_t allocLoad();
+    uint32_t allocPrefix();
+    void allocSlot(uint8_t field);
+};
@@ -17,6 +17,7 @@
 #include "Controller.hh"
 
 #include <algorithm>
+#include <atomic>
 #include <unordered_map>
 #include <vector>
 #include <list>
@@ -25,28 +26,110 @@
 #include <sstream>
 #include <memory>
 
+#include <pthread.h>
+#include <sched.h>
 #include <fluid/OFServer.hh>
 
+#include "Arena.hh"
 #include "TraceTree.hh"
+#include "MicroflowCache.hh"
 #include "Flow.hh"
 #include "Packet.hh"
+#include "PacketInView.hh"
 #include "OFMsgUnion.hh"
+#include "PendingMisses.hh"
+#include "SendBuffer.hh"
+#include "SwitchIndex.hh"
 
 REGISTER_APPLICATION(Controller, {""})
 
 typedef std::list< std::unique_ptr<OFMessageHandler> > HandlerPipeline;
 
+// Connection thread of the OpenFlow server and handlers used by it
+struct Worker {
+    HandlerPipeline pipeline;
+    std::atomic<unsigned> switches;
+    std::atomic<uint64_t> packet_ins;
+    std::atomic<uint64_t> misses;
+
+    Worker() : switches(0), packet_ins(0), misses(0) { }
+};
+
+// Index of the worker running on the calling thread
+static thread_local int worker_id = -1;
+
 // TODO: Can we implement similar SwitchStorage?
 class SwitchScope {
 public:
+    /**
+     * Held while a message or timer of the switch is handled. Usually
+     * only the connection thread takes it, but connections of a switch
+     * reconnecting to another worker may be handled at once.
+     */
+    std::mutex mutex;
     TraceTree trace_tree;
+    MicroflowCache emc;
     OFConnection* ofconn;
-    HandlerPipeline pipeline;
-
-    void processTableMiss(of13::PacketIn& pi);
+    // Worker of the current connection, pipeline is shared with its switches
+    Worker* worker;
+    // Rules reported by the table stats parts received so far
+    unsigned table_rules;
+    // Flow table updates are deferred for this time after a miss
+    unsigned coalesce_window_us;
+    // Zero or the number of deferred misses forcing an update
+    unsigned coalesce_max_misses;
+    unsigned deferred;
+    // Transient objects of the packet-in being processed
+    Arena arena;
+    // Misses of flows whose rules aren't confirmed yet
+    PendingMisses pending_misses;
+    // Flow of the last packet-out decision, reused by the next miss
+    Flow* spare_flow;
+
+    ~SwitchScope() { delete spare_flow; }
+
+    void processTableMiss(const PacketInView& pi);
+    Flow* makeFlow(Packet* pkt);
+    void disposeFlow(Flow* flow);
     void processFlowRemoved(Flow* flow, uint8_t reason);
+    void processError(of13::Error& error);
+    void processTableReply(OFMsgUnion& reply);
+    void queryTables();
+    void requestStats();
+    void sendTableQuery(OFMsg& request);
+    void sendPacketOut(const PacketInView& pi, Packet* pkt, Flow* flow);
+    void flushFlowTable();
+    void parkMiss(const PacketInView& pi, Packet* pkt, TraceTreeNode::LeafData* leaf);
+    void confirmInstall();
+    void releaseMisses();
 };
 
+// Table features and stats are requested by every switch scope itself.
+// Replies are told by this xid, just below the xids of pacer barriers.
+static const uint32_t tableQueryXid = 0x7fffffff;
+
+// Period of flushes requested by other threads when misses aren't coalesced
+static const int flushInterval = 50; // ms
+
+// Timer of the connection, it is destroyed with the connection.
+// Deferred rules and rebuilds requested by other threads are sent here.
+static void* flushDeferred(void* arg)
+{
+    OFConnection* ofconn = static_cast<OFConnection*>(arg);
+    SwitchScope* ctx = static_cast<SwitchScope*>(ofconn->get_application_data());
+    if (ctx == nullptr)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(ctx->mutex);
+    // Scope could be taken over by another connection of the switch
+    if (ctx->ofconn == ofconn &&
+            (ctx->deferred > 0 || ctx->trace_tree.needsUpdate())) {
+        Cork cork(ofconn);
+        ctx->flushFlowTable();
+    }
+    return nullptr;
+}
+
 class ControllerImpl : public OFServer {
     const uint32_t min_xid = 0xff;
     Controller *app;
@@ -56,7 +139,13 @@ public:
     bool cbench;
     Config config;
     std::vector<OFMessageHandlerFactory *> pipeline_factory;
-    std::unordered_map<uint64_t, SwitchScope> switch_scope;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<unsigned> next_worker;
+    // First CPU workers are pinned to, -1 disables pinning
+    int worker_cpu_base;
+    // Indexed by SwitchIndex, scopes are kept after disconnection
+    std::vector<std::unique_ptr<SwitchScope>> switch_scope;
+    std::mutex switch_scope_mutex;
 
     // OFResponse
     std::vector<OFTransaction *> static_ofresponse;
@@ -70,9 +159,13 @@ public:
             const bool secure = false,
             const class OFServerSettings ofsc = OFServerSettings())
             : OFServer(address, port, nthreads, secure, ofsc),
-              app(_app), started(false),
+              app(_app), started(false), next_worker(0), worker_cpu_base(-1),
               min_session_xid(min_xid) // last_xid(min_xid)
-    { }
+    {
+        workers.resize(nthreads);
+        for (auto& worker : workers)
+            worker.reset(new Worker());
+    }
 
     ~ControllerImpl()
     { }
@@ -93,6 +186,8 @@ public:
 
         SwitchScope *ctx = reinterpret_cast<SwitchScope *>(ofconn->get_application_data());
         Flow* flow;
+        // Replies to the message are written at once
+        Cork cork(ofconn);
 
         if (ctx == nullptr && type != of13::OFPT_FEATURES_REPLY) {
             LOG(ERROR) << "Switch send message before feature reply";
@@ -100,22 +195,52 @@ public:
             return;
         }
 
+        // Features reply locks the scope it gets
+        std::unique_lock<std::mutex> scope_lock;
+        if (type != of13::OFPT_FEATURES_REPLY) {
+            scope_lock = std::unique_lock<std::mutex>(ctx->mutex);
+            if (ctx->ofconn != ofconn) {
+                // Switch connected again, this connection is going away
+                free_data(data);
+                return;
+            }
+        }
+
+        // Packet-ins are read in place, other messages are unpacked
+        if (type == of13::OFPT_PACKET_IN) {
+            ctx->worker->packet_ins.fetch_add(1, std::memory_order_relaxed);
+            PacketInView pi;
+            if (not pi.parse(static_cast<uint8_t*>(data), len)) {
+                LOG(WARNING) << "Malformed message received from connection " << ofconn->get_id();
+            } else if (TraceTree::isTableMiss(pi)) {
+                ctx->processTableMiss(pi);
+            } else {
+                LOG(ERROR) << "TODO: to-controller packet-ins"; // TODO
+            }
+            free_data(data);
+            return;
+        }
+
         try {
             OFMsgUnion msg(type, data, len);
 
             switch (type) {
-            case of13::OFPT_PACKET_IN:
-                if (TraceTree::isTableMiss(msg.packetIn)) {
-                    ctx->processTableMiss(msg.packetIn);
-                } else {
-                    LOG(ERROR) << "TODO: to-controller packet-ins"; // TODO
-                }
-                break;
-            case of13::OFPT_FEATURES_REPLY:
-                ctx = createSwitchScope(ofconn, msg.featuresReply.datapath_id());
+            case of13::OFPT_FEATURES_REPLY: {
+                // Timers can't be removed, so only the first reply adds one
+                bool first = (ctx == nullptr);
+                ctx = createSwitchScope(ofconn, msg.featuresReply.datapath_id(),
+                                        msg.featuresReply.n_tables());
+                std::lock_guard<std::mutex> features_lock(ctx->mutex);
                 ofconn->set_application_data(ctx);
+                ctx->queryTables();
+                if (first) {
+                    int interval = ctx->coalesce_window_us > 0 ?
+                            (ctx->coalesce_window_us + 999) / 1000 : flushInterval;
+                    ofconn->add_timed_callback(flushDeferred, interval, ofconn);
+                }
                 emit app->switchUp(ctx->ofconn, msg.featuresReply);
                 break;
+            }
             case of13::OFPT_PORT_STATUS:
                 if (ctx == nullptr) break;
                 emit app->portStatus(ctx->ofconn, msg.portStatus);
@@ -123,11 +248,23 @@ public:
             case of13::OFPT_FLOW_REMOVED:
                 if (ctx == nullptr) break;
                 if (msg.flowRemoved.reason() == of13::OFPRR_DELETE) break;
+                ctx->trace_tree.removed(msg.flowRemoved.cookie());
                 flow = ctx->trace_tree.find(msg.flowRemoved.cookie());
                 ctx->processFlowRemoved(flow, msg.flowRemoved.reason());
                 break;
             default: {
+                if (type == of13::OFPT_ERROR)
+                    ctx->processError(msg.error);
+
                 uint32_t xid = msg.base()->xid();
+                if (type == of13::OFPT_BARRIER_REPLY &&
+                        ctx->trace_tree.pacer().barrierReply(ctx->ofconn, xid))
+                    break;
+                if (xid == tableQueryXid) {
+                    if (type == of13::OFPT_MULTIPART_REPLY)
+                        ctx->processTableReply(msg);
+                    break;
+                }
                 if (xid < min_xid)
                     break;
 
@@ -180,9 +317,8 @@ public:
             LOG(INFO) << "Connection id=" << ofconn->get_id() << " closed by the user";
             if (ctx) {
                 ofconn->set_application_data(nullptr);
-                emit app->switchDown(ctx->ofconn);
-                ctx->ofconn = nullptr;
-                ctx->trace_tree.clear();
+                emit app->switchDown(ofconn);
+                detachSwitchScope(ctx, ofconn);
             }
         }
 
@@ -190,13 +326,64 @@ public:
             LOG(INFO) << "Connection id=" << ofconn->get_id() << " closed due to inactivity";
             if (ctx) {
                 ofconn->set_application_data(nullptr);
-                emit app->switchDown(ctx->ofconn);
-                ctx->ofconn = nullptr;
-                ctx->trace_tree.clear();
+                emit app->switchDown(ofconn);
+                detachSwitchScope(ctx, ofconn);
             }
         }
     }
 
+    void detachSwitchScope(SwitchScope* ctx, OFConnection* ofconn)
+    {
+        std::lock_guard<std::mutex> lock(ctx->mutex);
+        // Switch is connected again and the scope is taken over
+        if (ctx->ofconn != ofconn)
+            return;
+
+        ctx->worker->switches.fetch_sub(1, std::memory_order_relaxed);
+        ctx->ofconn = nullptr;
+        ctx->trace_tree.clear();
+        ctx->emc.clear();
+        ctx->pending_misses.clear();
+        ctx->deferred = 0;
+        ctx->table_rules = 0;
+    }
+
+    void createPipelines()
+    {
+        for (auto& worker : workers) {
+            for (auto &factory : pipeline_factory)
+                worker->pipeline.push_back(factory->makeOFMessageHandler());
+        }
+    }
+
+    // Workers are bound to server threads as they call back first time
+    Worker* currentWorker()
+    {
+        if (worker_id < 0) {
+            worker_id = next_worker.fetch_add(1) % workers.size();
+            if (worker_cpu_base >= 0)
+                pinWorker(worker_id);
+        }
+        return workers[worker_id].get();
+    }
+
+    void pinWorker(int id)
+    {
+        unsigned ncpus = std::max(1u, std::thread::hardware_concurrency());
+        unsigned cpu = (worker_cpu_base + id) % ncpus;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            LOG(WARNING) << "Can't pin worker " << id << " to CPU " << cpu
+                         << ": error " << err;
+        } else {
+            LOG(INFO) << "Worker " << id << " pinned to CPU " << cpu;
+        }
+    }
+
     void sortPipeline()
     {
         std::sort(pipeline_factory.begin(), pipeline_factory.end(),
@@ -223,51 +410,54 @@ public:
             LOG(INFO) << "  * " << factory->orderingName();
     }
 
-    SwitchScope *createSwitchScope(OFConnection *ofconn, uint64_t dpid)
+    SwitchScope *createSwitchScope(OFConnection *ofconn, uint64_t dpid, uint8_t ntables)
     {
-        static std::mutex mutex;
-
-        auto it = switch_scope.find(dpid);
-        if (it != switch_scope.end())
-            goto ret;
-
-        mutex.lock();
-        it = switch_scope.find(dpid);
-        if (it != switch_scope.end()) {
-            mutex.unlock();
-            goto ret;
-        }
-
-        it = switch_scope.emplace(std::piecewise_construct,
-                                  std::forward_as_tuple(dpid),
-                                  std::forward_as_tuple()).first;
-
-        {
-            auto& swctx = it->second;
-            // Create pipeline
-            for (auto &factory : pipeline_factory) {
-                swctx.pipeline.push_back(std::move(factory->makeOFMessageHandler()));
-            }
+        unsigned index = SwitchIndex::intern(dpid);
+        std::unique_lock<std::mutex> lock(switch_scope_mutex);
+
+        if (index >= switch_scope.size())
+            switch_scope.resize(index + 1);
+        if (not switch_scope[index]) {
+            switch_scope[index].reset(new SwitchScope());
+            auto& swctx = *switch_scope[index];
+            swctx.trace_tree.setCompiled(config_get(config, "compiled_lookup", false));
+            swctx.trace_tree.setCompression(config_get(config, "compress_rules", false));
+            // Table 0 dispatches to one of two interleaved pipelines
+            unsigned stages = config_get(config, "pipeline_tables", 1);
+            swctx.trace_tree.setPipeline(std::min(stages, (ntables - 1u) / 2));
+            swctx.trace_tree.setCapacity(config_get(config, "table_capacity", 0));
+            swctx.trace_tree.pacer().setWindow(config_get(config, "flowmod_window", 0));
+            swctx.table_rules = 0;
+            swctx.coalesce_window_us = config_get(config, "coalesce_window_us", 0);
+            swctx.coalesce_max_misses = config_get(config, "coalesce_max_misses", 0);
+            swctx.deferred = 0;
+            swctx.emc.resize(config_get(config, "emc_size", 4096));
+            swctx.pending_misses.resize(config_get(config, "pending_miss_buffer", 0));
             swctx.trace_tree.cleanFlowTable(ofconn);
         }
-        mutex.unlock();
+        SwitchScope *ctx = switch_scope[index].get();
+        lock.unlock();
 
-        ret:
-        SwitchScope *ctx = &it->second;
+        std::lock_guard<std::mutex> scope_lock(ctx->mutex);
         if (ctx->ofconn != nullptr) {
             LOG(ERROR) << "Overwriting switch scope on active connection";
+            ctx->worker->switches.fetch_sub(1, std::memory_order_relaxed);
         }
         ctx->ofconn = ofconn;
+        // Switch is handled by the thread its connection was accepted to
+        ctx->worker = currentWorker();
+        ctx->worker->switches.fetch_add(1, std::memory_order_relaxed);
+        LOG(INFO) << "Switch dpid=" << dpid << " is handled by worker " << worker_id;
 
         return ctx;
     }
 };
 
-void SwitchScope::processTableMiss(of13::PacketIn& pi)
+void SwitchScope::processTableMiss(const PacketInView& pi)
 {
     auto conn_id = ofconn->get_id();
-    auto pkt     = new Packet(pi);
-    auto leaf    = trace_tree.find(pkt);
+    auto pkt     = arena.make<Packet>(pi, arena);
+    auto leaf    = emc.find(trace_tree, pkt);
 
     DVLOG(10) << "Table miss on connection id=" << conn_id;
 
@@ -280,8 +470,9 @@ void SwitchScope::processTableMiss(of13::PacketIn& pi)
         //  1) Flow space: which fields are used to make decision.
         //  2) Decision: forward to port, modify fields, drop.
         //  3) Timeout: how many time decision is valid.
-        Flow* flow = new Flow(pkt);
-        for (auto& handler : pipeline) {
+        Flow* flow = makeFlow(pkt);
+        worker->misses.fetch_add(1, std::memory_order_relaxed);
+        for (auto& handler : worker->pipeline) {
             if (handler->processMiss(ofconn, flow) == OFMessageHandler::Stop)
                 break;
         }
@@ -290,49 +481,23 @@ void SwitchScope::processTableMiss(of13::PacketIn& pi)
             // Sometimes we don't need to create a new flow on the switch.
             // So, reply to the packet-in using packet-out message.
             DVLOG(9) << "Sending packet-out";
-
-            of13::PacketOut po;
-            po.xid(pi.xid());
-            po.buffer_id(pi.buffer_id());
-            if (pi.buffer_id() == OFP_NO_BUFFER)
-                po.data(pi.data(), pi.data_len());
-            flow->initPacketOut(&po);
-
-            uint8_t* buffer = po.pack();
-            ofconn->send(buffer, po.length());
-            OFMsg::free_buffer(buffer);
-
-            flow->deleteLater();
+            sendPacketOut(pi, pkt, flow);
+            flow->releasePacket();
+            disposeFlow(flow);
         } else {
             // In other cases we need to add newly created Flow into the
-            // trace tree and rebuild it [TODO: incrementaly].
-            DVLOG(5) << "Rebuilding flow table on conn = " << conn_id;
-
-            static const struct Barrier {
-                uint8_t* data;
-                size_t len;
-                Barrier() {
-                    of13::BarrierRequest br;
-                    data = br.pack();
-                    len = br.length();
-                }
-                ~Barrier() { OFMsg::free_buffer(data); }
-            } barrier;
+            // trace tree and update the flow table.
+            DVLOG(5) << "Updating flow table on conn = " << conn_id;
 
-            // Initialize flow mod
+            // Initialize flow mod. The leaf owns it together with the
+            // flow, both live as long as the rule may be reinstalled.
             of13::FlowMod* fm = new of13::FlowMod();
             fm->xid(pi.xid());
             fm->buffer_id(pi.buffer_id());
-            if (pi.buffer_id() == OFP_NO_BUFFER) {
-                of13::PacketOut po;
-                po.xid(pi.xid());
-                po.buffer_id(OFP_NO_BUFFER);
-                po.data(pi.data(), pi.data_len());
-                flow->initPacketOut(&po);
-
-                uint8_t* buffer = po.pack();
-                ofconn->send(buffer, po.length());
-                OFMsg::free_buffer(buffer);
+            // Deferred rule would release the buffered packet too late
+            if (pi.buffer_id() == OFP_NO_BUFFER || coalesce_window_us > 0) {
+                sendPacketOut(pi, pkt, flow);
+                fm->buffer_id(OFP_NO_BUFFER);
             }
             fm->command(of13::OFPFC_ADD);
             flow->setFlags(Flow::TrackFlowRemoval);
@@ -340,6 +505,7 @@ void SwitchScope::processTableMiss(of13::PacketIn& pi)
 
             // Add new leaf to the trace tree
             trace_tree.augment(flow, fm);
+            pending_misses.install(fm->cookie());
             if (VLOG_IS_ON(10)) {
                 std::stringstream ss;
                 trace_tree.dump(ss);
@@ -347,18 +513,25 @@ void SwitchScope::processTableMiss(of13::PacketIn& pi)
                     << std::endl << ss.str();
             }
 
-            // Rebuild flow table from scratch.
-            // We will do incremental update in the future.
-            trace_tree.cleanFlowTable(ofconn);
-            ofconn->send(barrier.data, barrier.len);
-            unsigned rules = trace_tree.buildFlowTable(ofconn);
-
-            DVLOG(5) << rules << " rules generated for switch on conn = " << conn_id;
+            // Install only rules added by this trace, or by all traces
+            // of the coalescing window
+            ++deferred;
+            if (coalesce_window_us == 0 ||
+                    (coalesce_max_misses > 0 && deferred >= coalesce_max_misses))
+                flushFlowTable();
 
             // FIXME: Can flow be expired and free'd at this point?
             flow->setLive();
         }
 
+    } else if (pending_misses.installing(leaf->fm->cookie())) {
+        // Packet will be sent when the switch confirms the rule
+        DVLOG(9) << "Parking miss of a rule being installed";
+        parkMiss(pi, pkt, leaf);
+    } else if (trace_tree.pending(leaf)) {
+        // Rule will be installed at the end of the coalescing window
+        DVLOG(9) << "Sending packet-out for a deferred rule";
+        sendPacketOut(pi, pkt, leaf->flow);
     } else {
         // Flow removed from the switch by idle timeout, but
         // still valid (by hard timeout). Reinstall it without
@@ -366,16 +539,108 @@ void SwitchScope::processTableMiss(of13::PacketIn& pi)
 
         DVLOG(5) << "Reinstalling rule from the trace tree";
         // Flow removed by idleTimeout but still actual
-        of13::FlowMod* fm = leaf->fm;
-        fm->xid(pi.xid());
-        fm->buffer_id(pi.buffer_id());
-        leaf->flow->initFlowMod(fm);
+        TraceTreeNode::LeafData* installed =
+            trace_tree.reinstall(leaf, ofconn, pi.xid(), pi.buffer_id());
+        if (installed) {
+            pending_misses.install(installed->fm->cookie());
+            confirmInstall();
+            installed->flow->setLive();
+        } else {
+            // Shared rule will be emitted by the table rebuild
+            sendPacketOut(pi, pkt, leaf->flow);
+        }
+        leaf->flow->setLive();
+    }
 
-        uint8_t* buffer = fm->pack();
-        ofconn->send(buffer, fm->length());
-        OFMsg::free_buffer(buffer);
+    if (trace_tree.needsStats())
+        requestStats();
 
-        leaf->flow->setLive();
+    // Leaves found for this packet aren't used anymore
+    trace_tree.quiesce();
+    arena.reset();
+}
+
+Flow* SwitchScope::makeFlow(Packet* pkt)
+{
+    // Whether the flow outlives the packet-in is known only after
+    // handlers, so every miss starts with a heap flow. Packet-out
+    // decisions keep it for the next miss instead of freeing it.
+    if (spare_flow) {
+        Flow* ret = spare_flow;
+        spare_flow = nullptr;
+        ret->reset(pkt);
+        return ret;
+    }
+    return new Flow(pkt);
+}
+
+void SwitchScope::disposeFlow(Flow* flow)
+{
+    if (spare_flow)
+        flow->deleteLater();
+    else
+        spare_flow = flow;
+}
+
+void SwitchScope::sendPacketOut(const PacketInView& pi, Packet* pkt, Flow* flow)
+{
+    bool buffered = pi.buffer_id() != OFP_NO_BUFFER;
+
+    // Live flows don't keep their packets
+    SendBuffer buf;
+    buf.appendPacketOut(pi.xid(), pi.buffer_id(), pkt->readInPort(), flow->get_action(),
+                        pi.data(), buffered ? 0 : pi.data_len());
+    buf.send(ofconn);
+}
+
+void SwitchScope::parkMiss(const PacketInView& pi, Packet* pkt, TraceTreeNode::LeafData* leaf)
+{
+    bool buffered = pi.buffer_id() != OFP_NO_BUFFER;
+    pending_misses.park(leaf->fm->cookie(), pi.xid(), pi.buffer_id(), pkt->readInPort(),
+                        pi.data(), buffered ? 0 : pi.data_len());
+}
+
+void SwitchScope::confirmInstall()
+{
+    if (pending_misses.seal())
+        trace_tree.pacer().barrier(ofconn, [this](FlowModPacer::Clock::time_point) {
+            releaseMisses();
+        });
+}
+
+void SwitchScope::releaseMisses()
+{
+    SendBuffer buf;
+    pending_misses.release([&](const PendingMisses::Parked& p) {
+        // Flow could be removed while its rules were installed
+        TraceTreeNode::LeafData* leaf = trace_tree.leaf(p.cookie);
+        if (leaf == nullptr)
+            return;
+        buf.appendPacketOut(p.xid, p.buffer_id, p.in_port, leaf->flow->get_action(),
+                            p.data, p.data_len);
+    });
+    if (not buf.empty()) {
+        DVLOG(9) << "Releasing parked misses on conn = " << ofconn->get_id();
+        buf.send(ofconn);
+    }
+}
+
+void SwitchScope::flushFlowTable()
+{
+    unsigned rules = trace_tree.updateFlowTable(ofconn);
+    DVLOG(5) << rules << " rules generated for " << deferred
+             << " misses on conn = " << ofconn->get_id();
+    deferred = 0;
+    confirmInstall();
+
+    if (VLOG_IS_ON(5) && rules > 0) {
+        auto sent = FlowModPacer::Clock::now();
+        auto conn_id = ofconn->get_id();
+        trace_tree.pacer().barrier(ofconn, [sent, rules, conn_id](FlowModPacer::Clock::time_point installed) {
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(installed - sent);
+            VLOG(5) << rules << " rules installed in " << us.count()
+                    << " us on conn = " << conn_id;
+        });
     }
 }
 
@@ -389,6 +654,79 @@ void SwitchScope::processFlowRemoved(Flow *flow, uint8_t reason)
     }
 }
 
+void SwitchScope::processError(of13::Error& error)
+{
+    if (error.type() == of13::OFPET_FLOW_MOD_FAILED &&
+            error.code() == of13::OFPFMFC_TABLE_FULL)
+        trace_tree.tableFull();
+}
+
+void SwitchScope::queryTables()
+{
+    // Configured capacity takes precedence over reported one
+    if (trace_tree.capacity() == 0) {
+        of13::MultipartRequestTableFeatures features(tableQueryXid, 0);
+        sendTableQuery(features);
+    }
+}
+
+void SwitchScope::requestStats()
+{
+    DVLOG(5) << "Requesting flow stats on conn = " << ofconn->get_id();
+
+    of13::MultipartRequestFlow flows(tableQueryXid, 0, of13::OFPTT_ALL, of13::OFPP_ANY,
+                                     of13::OFPG_ANY, TraceTree::cookieBase,
+                                     TraceTree::cookieMask);
+    sendTableQuery(flows);
+
+    of13::MultipartRequestTable tables(tableQueryXid, 0);
+    sendTableQuery(tables);
+}
+
+void SwitchScope::sendTableQuery(OFMsg& request)
+{
+    SendBuffer buf;
+    buf.append(request);
+    buf.send(ofconn);
+}
+
+void SwitchScope::processTableReply(OFMsgUnion& reply)
+{
+    switch (reply.multipartReply.mpart_type()) {
+    case of13::OFPMP_TABLE_FEATURES: {
+        // Rules may go to any table of the pipeline
+        unsigned capacity = trace_tree.capacity();
+        for (auto& features : reply.multipartReplyTableFeatures.tables_features()) {
+            uint32_t entries = features.max_entries();
+            if (trace_tree.usesTable(features.table_id()) && entries > 0 &&
+                    (capacity == 0 || entries < capacity))
+                capacity = entries;
+        }
+        DVLOG(5) << "Flow table capacity is " << capacity << " on conn = " << ofconn->get_id();
+        trace_tree.setCapacity(capacity);
+        break;
+    }
+    case of13::OFPMP_TABLE: {
+        for (auto& stats : reply.multipartReplyTable.table_stats()) {
+            if (trace_tree.usesTable(stats.table_id()))
+                table_rules += stats.active_count();
+        }
+        // Stats of many tables may be split into several parts
+        if (reply.multipartReply.flags() & of13::OFPMPF_REPLY_MORE)
+            break;
+        trace_tree.setOccupancy(table_rules);
+        table_rules = 0;
+        break;
+    }
+    case of13::OFPMP_FLOW:
+        for (auto& stats : reply.multipartReplyFlow.flow_stats())
+            trace_tree.hit(stats.cookie(), stats.packet_count());
+        break;
+    default:
+        break;
+    }
+}
+
 /* Application interface */
 Controller::Controller()
     : impl(nullptr)
@@ -412,6 +750,7 @@ void Controller::init(Loader*, const Config& rootConfig)
                     .liveness_check(config_get(config, "liveness_check", true))
     );
     impl->config = config;
+    impl->worker_cpu_base = config_get(config, "worker_cpu_base", -1);
 }
 
 Controller::~Controller() {
@@ -421,6 +760,7 @@ Controller::~Controller() {
 void Controller::startUp(Loader*)
 {
     impl->sortPipeline();
+    impl->createPipelines();
     impl->start(/* block: */ false);
     impl->started = true;
     impl->cbench = config_get(impl->config, "cbench", false);
@@ -458,7 +798,24 @@ OFTransaction* Controller::registerStaticTransaction(Application *caller)
     return ret;
 }
 
+std::vector<Controller::WorkerLoad> Controller::workerLoad() const
+{
+    std::vector<WorkerLoad> ret;
+    for (auto& worker : impl->workers) {
+        ret.push_back(WorkerLoad{
+            worker->switches.load(std::memory_order_relaxed),
+            worker->packet_ins.load(std::memory_order_relaxed),
+            worker->misses.load(std::memory_order_relaxed)
+        });
+    }
+    return ret;
+}
+
 TraceTree* Controller::getTraceTree(uint64_t dpid)
 {
-    return &impl->switch_scope[dpid].trace_tree;
+    unsigned index = SwitchIndex::find(dpid);
+    std::lock_guard<std::mutex> lock(impl->switch_scope_mutex);
+    if (index >= impl->switch_scope.size() || not impl->switch_scope[index])
+        return nullptr;
+    return &impl->switch_scope[index]->trace_tree;
 }
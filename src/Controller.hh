@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "Common.hh"
 #include "Application.hh"
 #include "Loader.hh"
@@ -37,6 +39,7 @@ public:
 
     /**
     * Registers new message handler for each worker thread.
+    * Handlers are shared by switches of the worker.
     * Used for performance-critical message processing, such as packet-in's.
     */
     void registerHandler(OFMessageHandlerFactory* hf);
@@ -50,8 +53,22 @@ public:
      */
     OFTransaction* registerStaticTransaction(Application* caller);
 
+    /// Trace tree of the switch or nullptr if it never connected
     TraceTree* getTraceTree(uint64_t dpid);
 
+    struct WorkerLoad {
+        unsigned switches;
+        uint64_t packet_ins;
+        // Packet-ins passed through the handler pipeline
+        uint64_t misses;
+    };
+
+    /**
+     * Load of the connection threads since startup, indexed by worker.
+     * Switches stay on the worker their connection was accepted by.
+     */
+    std::vector<WorkerLoad> workerLoad() const;
+
 signals:
 
     /**
@@ -18,6 +18,7 @@
 
 #include <chrono>
 #include "Match.hh"
+#include "OXMTLVUnion.hh"
 
 using std::chrono::time_point;
 using std::chrono::steady_clock;
@@ -27,6 +28,9 @@ typedef time_point<steady_clock> timepoint_t;
 typedef Flow::FlowState FlowState;
 typedef Flow::FlowFlags FlowFlags;
 
+// Enough for most handler pipelines to build the trace without regrowth
+static const size_t traceReserve = 16;
+
 struct FlowImpl {
     // Initialization
     Packet*               pkt;
@@ -47,8 +51,9 @@ struct FlowImpl {
         : pkt(pkt_),
           state(Flow::New),
           flags((FlowFlags) 0),
-          live_until(timepoint_t::max())
-    { }
+          live_until(timepoint_t::max()),
+          idle_timeout(0)
+    { trace.reserve(traceReserve); }
 };
 
 Flow::Flow(Packet* pkt, QObject* parent)
@@ -114,6 +119,23 @@ void Flow::setShadow()
     emit stateChanged(m->state, old_state);
 }
 
+void Flow::releasePacket()
+{ m->pkt = nullptr; }
+
+void Flow::reset(Packet* pkt)
+{
+    // Handlers watching the previous decision don't see the next one
+    disconnect();
+
+    m->pkt = pkt;
+    m->state = New;
+    m->flags = (FlowFlags) 0;
+    m->trace.clear();
+    m->live_until = timepoint_t::max();
+    m->idle_timeout = 0;
+    m->actions = ActionList();
+}
+
 void Flow::setDestroy()
 {
     auto old_state = m->state;
@@ -196,6 +218,25 @@ void Flow::load(of13::OXMTLV& tlv)
     m->trace.push_back(TraceEntry(TraceEntry::Load, tlv));
 }
 
+int Flow::matchPrefix(PrefixSetPtr prefixes)
+{
+    OXMTLVUnion value(prefixes->field());
+    m->pkt->read(value);
+
+    int index = prefixes->lookup(value.base());
+    m->trace.push_back(TraceEntry(*value.base(), std::move(prefixes), index));
+    return index;
+}
+
+#define MATCH_RANGE_IMPL(field) \
+    bool Flow::matchRange(const of13::field& lo, const of13::field& hi) \
+    { \
+        auto value = m->pkt->read##field(); \
+        bool res = lo.value() <= value && value <= hi.value(); \
+        m->trace.push_back(TraceEntry(of13::field(value), lo.value(), hi.value(), res)); \
+        return res; \
+    }
+
 #define LOAD_IMPL(field) \
     decltype(of13::field().value()) Flow::load##field() \
     { \
@@ -238,6 +279,11 @@ LOAD_IMPL(TCPDst);
 LOAD_IMPL(UDPSrc);
 LOAD_IMPL(UDPDst);
 
+MATCH_RANGE_IMPL(TCPSrc);
+MATCH_RANGE_IMPL(TCPDst);
+MATCH_RANGE_IMPL(UDPSrc);
+MATCH_RANGE_IMPL(UDPDst);
+
 MATCH_IMPL(InPort);
 MATCH_IMPL(InPhyPort);
 MATCH_IMPL(Metadata);
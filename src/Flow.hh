@@ -160,6 +160,28 @@ public:
     bool match(const of13::UDPDst& val);
     //@}
 
+    /**
+     * Finds the longest prefix from the set that matches IPv4 field
+     * of the packet. Unlike the chain of masked match() calls this adds
+     * one node to the trace tree and one flow rule per prefix.
+     *
+     * @return Index of the matched prefix in the set or -1.
+     */
+    int matchPrefix(PrefixSetPtr prefixes);
+
+    //@{
+    /**
+     * Tests if a port of the packet is within [lo, hi].
+     * Rules are installed with the minimal set of masked port values
+     * covering the range, which requires switch support of masks on
+     * L4 ports (e.g. Open vSwitch).
+     */
+    bool matchRange(const of13::TCPSrc& lo, const of13::TCPSrc& hi);
+    bool matchRange(const of13::TCPDst& lo, const of13::TCPDst& hi);
+    bool matchRange(const of13::UDPSrc& lo, const of13::UDPSrc& hi);
+    bool matchRange(const of13::UDPDst& lo, const of13::UDPDst& hi);
+    //@}
+
     void add_action(Action* action);
     void add_action(Action& action);
 
@@ -182,6 +204,7 @@ signals:
 
 protected:
     friend class SwitchScope;
+    friend class TraceTree;
     friend class TraceTreeNode;
     friend class FlowManager;
     friend class PathVerifier;
@@ -195,6 +218,10 @@ protected:
     void setLive();
     void setShadow();
     void setDestroy();
+    // Packet is freed with the packet-in arena
+    void releasePacket();
+    // Prepares a disposed flow for the next miss, keeping its buffers
+    void reset(Packet* pkt);
     uint16_t hardTimeout();
 
 private:
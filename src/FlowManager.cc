@@ -16,6 +16,9 @@
 
 #include "FlowManager.hh"
 
+#include <algorithm>
+#include <memory>
+
 #include "Controller.hh"
 #include "RestListener.hh"
 
@@ -51,19 +54,20 @@ Rule::Rule(Flow* _flow, uint64_t _switch_id) :
     if (_flow) {
         Trace& trace = _flow->trace();
         for (TraceEntry& tr_entry : trace) {
-            switch (tr_entry.tlv->field()) {
+            std::unique_ptr<of13::OXMTLV> tlv(tr_entry.value.makeTLV());
+            switch (tlv->field()) {
             case of13::OFPXMT_OFB_IN_PORT:
-                in_port = ((of13::InPort*)tr_entry.tlv)->value(); break;
+                in_port = ((of13::InPort*)tlv.get())->value(); break;
             case of13::OFPXMT_OFB_ETH_SRC:
-                eth_src = ((of13::EthSrc*)tr_entry.tlv)->value(); break;
+                eth_src = ((of13::EthSrc*)tlv.get())->value(); break;
             case of13::OFPXMT_OFB_ETH_DST:
-                eth_dst = ((of13::EthDst*)tr_entry.tlv)->value(); break;
+                eth_dst = ((of13::EthDst*)tlv.get())->value(); break;
             case of13::OFPXMT_OFB_ETH_TYPE:
-                eth_type = ((of13::EthType*)tr_entry.tlv)->value(); break;
+                eth_type = ((of13::EthType*)tlv.get())->value(); break;
             case of13::OFPXMT_OFB_IPV4_SRC:
-                ip_src = ((of13::IPv4Src*)tr_entry.tlv)->value().getIPv4(); break;
+                ip_src = ((of13::IPv4Src*)tlv.get())->value().getIPv4(); break;
             case of13::OFPXMT_OFB_IPV4_DST:
-                ip_dst = ((of13::IPv4Dst*)tr_entry.tlv)->value().getIPv4(); break;
+                ip_dst = ((of13::IPv4Dst*)tlv.get())->value().getIPv4(); break;
             }
         }
 
@@ -137,6 +141,9 @@ void FlowManager::init(Loader *loader, const Config &config)
     sw_m = SwitchManager::get(loader);
     ctrl->registerHandler(this);
 
+    // Rules of the switch must have a slot before its packet-ins are handled
+    connect(sw_m, &SwitchManager::switchDiscovered, this, &FlowManager::onSwitchDiscovered,
+            Qt::DirectConnection);
     connect(sw_m, &SwitchManager::switchDown, this, &FlowManager::onSwitchDown);
 
     RestListener::get(loader)->registerRestHandler(this);
@@ -156,10 +163,11 @@ void FlowManager::addToFlowManager(Flow *flow, uint64_t dpid)
 
 void FlowManager::addRule(Switch* sw, Flow* flow, Rule::Type type)
 {
-    if (sw && flow) {
+    std::lock_guard<std::mutex> lock(rules_lock);
+    if (sw && flow && sw->index() < switch_rules.size()) {
         Rule* rule = new Rule(flow, sw->id());
         rule->type = type;
-        switch_rules[sw->ofconn()->get_id()].push_back(rule);
+        switch_rules[sw->index()].push_back(rule);
         flow_rule[rule->flow] = rule;
         connect(flow, &Flow::stateChanged, this, &FlowManager::onStateChanged);
     }
@@ -224,6 +232,7 @@ void FlowManager::dumpRule(Rule *rule)
 void FlowManager::onStateChanged(Flow::FlowState new_state, Flow::FlowState old_state)
 {
     Flow* flow = (Flow*)sender();
+    std::lock_guard<std::mutex> lock(rules_lock);
     Rule* rule = flow_rule[flow];
     if (new_state == Flow::FlowState::Live) {
         rule->active = true;
@@ -240,13 +249,23 @@ void FlowManager::onStateChanged(Flow::FlowState new_state, Flow::FlowState old_
     }
 }
 
+void FlowManager::onSwitchDiscovered(Switch *dp)
+{
+    std::lock_guard<std::mutex> lock(rules_lock);
+    if (dp->index() >= switch_rules.size())
+        switch_rules.resize(dp->index() + 1);
+}
+
 void FlowManager::onSwitchDown(Switch *dp)
 {
-    Rules rules = switch_rules[dp->ofconn()->get_id()];
+    std::lock_guard<std::mutex> lock(rules_lock);
+    if (dp->index() >= switch_rules.size())
+        return;
+    Rules& rules = switch_rules[dp->index()];
     for (Rule* rule : rules) {
         addEvent(Event::Delete, rule);
     }
-    switch_rules[dp->ofconn()->get_id()].clear();
+    rules.clear();
 }
 
 OFMessageHandler::Action FlowManager::Handler::processMiss(OFConnection* ofconn, Flow* flow)
@@ -263,9 +282,15 @@ json11::Json FlowManager::handleGET(std::vector<std::string> params, std::string
 {
     if (params[0] != "all") {
         uint64_t id = std::stoull(params[0]);
-        int conn_id = sw_m->getSwitch(id)->ofconn()->get_id();
+        Switch* sw = sw_m->getSwitch(id);
+        if (!sw) {
+            return "{\"error\": \"switch not found\"}";
+        }
         Rules active_rules;
-        for (auto rule : switch_rules[conn_id]) {
+        std::lock_guard<std::mutex> lock(rules_lock);
+        if (sw->index() >= switch_rules.size())
+            return json11::Json(active_rules);
+        for (auto rule : switch_rules[sw->index()]) {
             if (rule->active)
                 active_rules.push_back(rule);
         }
@@ -282,48 +307,41 @@ json11::Json FlowManager::handleDELETE(std::vector<std::string> params, std::str
     if (!sw) {
         return "{\"error\": \"switch now found\"}";
     }
-    OFConnection* ofconn = sw->ofconn();
-    int conn_id = ofconn->get_id();
     uint64_t flow_id = std::stoull(params[1]);
     TraceTree* trace_tree = ctrl->getTraceTree(id);
 
-    if (switch_rules.find(conn_id) == switch_rules.end()) {
-        return "{\"error\": \"switch has not flows\"}";
-    }
-    Rules rules = switch_rules[conn_id];
-    int elem = 0;
-    for (Rule* rule : rules) {
-        if (rule->id() == flow_id) {
-            deleteRule(sw_m->getSwitch(id), rule);
-            for (auto it : flow_rule) {
-                if (it.second == rule) {
-                    it.first->setDestroy();
-                    switch_rules[conn_id].erase(switch_rules[conn_id].begin() + elem);
-
-                    if (rule->type == Rule::TraceTree) {
-                        static const struct Barrier {
-                            uint8_t* data;
-                            size_t len;
-                            Barrier() {
-                                of13::BarrierRequest br;
-                                data = br.pack();
-                                len = br.length();
-                            }
-                            ~Barrier() { OFMsg::free_buffer(data); }
-                        } barrier;
-
-                        trace_tree->cleanFlowTable(ofconn);
-                        ofconn->send(barrier.data, barrier.len);
-                        trace_tree->buildFlowTable(ofconn);
-                    }
-                    break;
+    // State change of the flow takes the lock again
+    Flow* destroyed = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(rules_lock);
+        if (sw->index() >= switch_rules.size() || switch_rules[sw->index()].empty()) {
+            return "{\"error\": \"switch has not flows\"}";
+        }
+        Rules& switch_flows = switch_rules[sw->index()];
+        auto rule_it = std::find_if(switch_flows.begin(), switch_flows.end(),
+                                    [flow_id](Rule* rule) { return rule->id() == flow_id; });
+        if (rule_it == switch_flows.end())
+            return "\"error\": \"flow not found\"";
+
+        Rule* rule = *rule_it;
+        deleteRule(sw, rule);
+        for (auto it : flow_rule) {
+            if (it.second == rule) {
+                destroyed = it.first;
+                switch_flows.erase(rule_it);
+
+                // Rules are rebuilt by the thread of the switch connection
+                if (rule->type == Rule::TraceTree && trace_tree) {
+                    trace_tree->invalidateFlowTable();
                 }
+                break;
             }
-            return "{\"flow-manager\": \"flow deleted\"}";
         }
-        ++elem;
     }
-    return "\"error\": \"flow not found\"";
+
+    if (destroyed)
+        destroyed->setDestroy();
+    return "{\"flow-manager\": \"flow deleted\"}";
 }
 
 bool FlowManager::isPrereq(const std::string &name) const
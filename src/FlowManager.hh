@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <mutex>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -84,6 +85,7 @@ public:
 
 protected slots:
     void onStateChanged(Flow::FlowState new_state, Flow::FlowState old_state);
+    void onSwitchDiscovered(Switch* dp);
     void onSwitchDown(Switch* dp);
 protected:
     void addRule(Switch *sw, Flow *flow, Rule::Type type);
@@ -92,8 +94,11 @@ protected:
 private:
     class Controller* ctrl;
     class SwitchManager* sw_m;
-    std::unordered_map<int, Rules> switch_rules;
+    // Indexed by Switch::index(), grows only when a switch comes up
+    std::vector<Rules> switch_rules;
     std::unordered_map<Flow*, Rule*> flow_rule;
+    // Handlers of all workers add rules of their switches at once
+    std::mutex rules_lock;
 
     class Handler: public OFMessageHandler {
     public:
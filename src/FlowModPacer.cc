@@ -0,0 +1,147 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FlowModPacer.hh"
+
+#include <algorithm>
+
+#include "MessageTemplate.hh"
+#include "SendBuffer.hh"
+
+// Barriers of the pacer use upper half of xids, switches reply
+// to the packet-ins they send with xids of their own
+static const uint32_t xidBase = 0x80000000;
+
+FlowModPacer::FlowModPacer()
+    : m_window(0), m_in_flight(0), m_xid(xidBase)
+{ }
+
+void FlowModPacer::setWindow(unsigned flowmods)
+{
+    m_window = flowmods;
+}
+
+bool FlowModPacer::fits(unsigned flowmods) const
+{
+    // Batch larger than the window is sent alone
+    return m_in_flight == 0 || m_in_flight + flowmods <= m_window;
+}
+
+void FlowModPacer::send(OFConnection* ofconn, const void* data, size_t len, unsigned flowmods)
+{
+    if (m_window == 0) {
+        sendToSwitch(ofconn, data, len);
+        return;
+    }
+
+    if (m_queue.empty() && fits(flowmods)) {
+        transmit(ofconn, data, len, flowmods, Completion());
+    } else {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        m_queue.push_back(Batch{ std::vector<uint8_t>(bytes, bytes + len), flowmods, Completion() });
+        DVLOG(10) << m_queue.size() << " flow-mod batches queued on conn = " << ofconn->get_id();
+    }
+}
+
+void FlowModPacer::barrier(OFConnection* ofconn, Completion done)
+{
+    if (m_window == 0) {
+        sendBarrier(ofconn, 0, std::move(done));
+        return;
+    }
+
+    // Every paced batch is followed by a barrier already
+    Completion* last = nullptr;
+    if (not m_queue.empty())
+        last = &m_queue.back().done;
+    else if (not m_barriers.empty())
+        last = &m_barriers.back().done;
+
+    if (not done) {
+        return;
+    } else if (last == nullptr) {
+        done(Clock::now());
+    } else if (not *last) {
+        *last = std::move(done);
+    } else {
+        Completion prev = std::move(*last);
+        *last = [prev, done](Clock::time_point installed) {
+            prev(installed);
+            done(installed);
+        };
+    }
+}
+
+bool FlowModPacer::barrierReply(OFConnection* ofconn, uint32_t xid)
+{
+    auto it = std::find_if(m_barriers.begin(), m_barriers.end(),
+                           [xid](const Barrier& b) { return b.xid == xid; });
+    if (it == m_barriers.end())
+        return false;
+
+    // Switch handles barriers in order, earlier ones are confirmed too
+    auto installed = Clock::now();
+    std::vector<Completion> done;
+    for (bool last = false; not last; m_barriers.pop_front()) {
+        Barrier& b = m_barriers.front();
+        last = (b.xid == xid);
+        m_in_flight -= std::min(b.flowmods, m_in_flight);
+        if (b.done)
+            done.push_back(std::move(b.done));
+    }
+
+    while (not m_queue.empty() && fits(m_queue.front().flowmods)) {
+        Batch batch = std::move(m_queue.front());
+        m_queue.pop_front();
+        transmit(ofconn, batch.data.data(), batch.data.size(),
+                 batch.flowmods, std::move(batch.done));
+    }
+
+    // Callbacks may send more flow-mods
+    for (auto& f : done)
+        f(installed);
+    return true;
+}
+
+void FlowModPacer::reset()
+{
+    m_queue.clear();
+    m_barriers.clear();
+    m_in_flight = 0;
+}
+
+void FlowModPacer::transmit(OFConnection* ofconn, const void* data, size_t len,
+                            unsigned flowmods, Completion done)
+{
+    if (len > 0)
+        sendToSwitch(ofconn, data, len);
+    sendBarrier(ofconn, flowmods, std::move(done));
+}
+
+void FlowModPacer::sendBarrier(OFConnection* ofconn, unsigned flowmods, Completion done)
+{
+    uint32_t xid = m_xid;
+    m_xid = (m_xid == 0xffffffff) ? xidBase : m_xid + 1;
+
+    static const MessageTemplate barrier((of13::BarrierRequest()));
+
+    SendBuffer buf;
+    MessageTemplate::setXid(barrier.copyTo(buf), xid);
+    buf.send(ofconn);
+
+    m_in_flight += flowmods;
+    m_barriers.push_back(Barrier{ xid, flowmods, std::move(done) });
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Common.hh"
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <vector>
+
+/**
+ * Paces flow-mods sent to one switch. Every batch is followed by
+ * a barrier and the number of flow-mods whose barriers aren't replied
+ * yet is limited by the window; batches beyond it wait in the queue.
+ * Barrier replies also tell when the rules are actually installed.
+ *
+ * With zero window flow-mods are sent at once and only explicit
+ * barriers are tracked. All methods are called from the thread
+ * of the switch connection and aren't synchronized: other threads
+ * request rebuilds by TraceTree::invalidateFlowTable() instead of
+ * sending flow-mods themselves.
+ */
+class FlowModPacer {
+public:
+    typedef std::chrono::steady_clock Clock;
+    /// Called with the time the switch confirmed the preceding flow-mods
+    typedef std::function<void(Clock::time_point installed)> Completion;
+
+    FlowModPacer();
+
+    /// Maximum number of unconfirmed flow-mods, 0 means unlimited
+    void setWindow(unsigned flowmods);
+    unsigned window() const { return m_window; }
+
+    /**
+     * Sends packed messages or queues them until the window allows.
+     * @param flowmods Number of flow-mods in the data.
+     */
+    void send(OFConnection* ofconn, const void* data, size_t len, unsigned flowmods);
+
+    /**
+     * Orders messages sent after the call after the preceding ones and
+     * calls `done` when the switch confirms all of the preceding.
+     */
+    void barrier(OFConnection* ofconn, Completion done = Completion());
+
+    /**
+     * Handles barrier reply, sends batches allowed by the window.
+     * @return False if the barrier wasn't sent by the pacer.
+     */
+    bool barrierReply(OFConnection* ofconn, uint32_t xid);
+
+    /// Forgets queued and unconfirmed messages of the closed connection
+    void reset();
+
+    unsigned inFlight() const { return m_in_flight; }
+    size_t queued() const { return m_queue.size(); }
+
+private:
+    struct Batch {
+        std::vector<uint8_t> data;
+        unsigned flowmods;
+        Completion done;
+    };
+    struct Barrier {
+        uint32_t xid;
+        unsigned flowmods;
+        Completion done;
+    };
+
+    unsigned m_window;
+    unsigned m_in_flight;
+    uint32_t m_xid;
+    std::deque<Batch> m_queue;
+    // Barriers sent in order of xids
+    std::deque<Barrier> m_barriers;
+
+    bool fits(unsigned flowmods) const;
+    void transmit(OFConnection* ofconn, const void* data, size_t len,
+                  unsigned flowmods, Completion done);
+    void sendBarrier(OFConnection* ofconn, unsigned flowmods, Completion done);
+
+    FlowModPacer(const FlowModPacer&) = delete;
+    FlowModPacer& operator=(const FlowModPacer&) = delete;
+};
@@ -127,6 +127,7 @@ void HostManager::onSwitchDiscovered(Switch* dp)
 
 void HostManager::onSwitchDown(Switch *dp)
 {
+    std::lock_guard<std::mutex> lk(mutex);
     delHostForSwitch(dp);
     for (of13::Port port : dp->ports()) {
         auto pos = std::find(switch_macs.begin(), switch_macs.end(), port.hw_addr().to_string());
@@ -135,14 +136,18 @@ void HostManager::onSwitchDown(Switch *dp)
     }
 }
 
-void HostManager::addHost(Switch* sw, IPAddress ip, std::string mac, uint32_t port)
+bool HostManager::addHost(Switch* sw, IPAddress ip, std::string mac, uint32_t port)
 {
     std::lock_guard<std::mutex> lk(mutex);
+    // Host could be added by a worker of another switch since the check
+    if (m->hosts.count(mac) > 0)
+        return false;
 
     Host* dev = createHost(mac, ip);
     attachHost(mac, sw->id(), port);
     addEvent(Event::Add, dev);
     dev->connectedSince(time(NULL));
+    return true;
 }
 
 Host* HostManager::createHost(std::string mac, IPAddress ip)
@@ -155,6 +160,7 @@ Host* HostManager::createHost(std::string mac, IPAddress ip)
 
 bool HostManager::findMac(std::string mac)
 {
+    std::lock_guard<std::mutex> lk(mutex);
     if (m->hosts.count(mac) > 0)
         return true;
     return false;
@@ -162,6 +168,7 @@ bool HostManager::findMac(std::string mac)
 
 bool HostManager::isSwitch(std::string mac)
 {
+    std::lock_guard<std::mutex> lk(mutex);
     for (auto sw_mac : switch_macs) {
         if (sw_mac == mac)
             return true;
@@ -190,6 +197,7 @@ void HostManager::delHostForSwitch(Switch *dp)
 
 Host* HostManager::getHost(std::string mac)
 {
+    std::lock_guard<std::mutex> lk(mutex);
     if (m->hosts.count(mac) > 0)
         return m->hosts[mac];
     else
@@ -198,6 +206,7 @@ Host* HostManager::getHost(std::string mac)
 
 Host* HostManager::getHost(IPAddress ip)
 {
+    std::lock_guard<std::mutex> lk(mutex);
     for (auto it : m->hosts) {
         if (it.second->ip() == AppObject::uint32_t_ip_to_string(ip.getIPv4()))
             return it.second;
@@ -207,6 +216,7 @@ Host* HostManager::getHost(IPAddress ip)
 
 void HostManager::newPort(Switch *dp, of13::Port port)
 {
+    std::lock_guard<std::mutex> lk(mutex);
     switch_macs.push_back(port.hw_addr().to_string());
 }
 
@@ -233,16 +243,16 @@ OFMessageHandler::Action HostManager::Handler::processMiss(OFConnection* ofconn,
 
     if (!app->findMac(host_mac)) {
         Switch* sw = app->m_switch_manager->getSwitch(ofconn);
-        app->addHost(sw, host_ip, host_mac, in_port);
-
-        LOG(INFO) << "Host discovered. MAC: " << host_mac
-                  << ", IP: " << AppObject::uint32_t_ip_to_string(host_ip.getIPv4())
-                  << ", Switch ID: " << sw->id() << ", port: " << in_port;
+        if (sw && app->addHost(sw, host_ip, host_mac, in_port)) {
+            LOG(INFO) << "Host discovered. MAC: " << host_mac
+                      << ", IP: " << AppObject::uint32_t_ip_to_string(host_ip.getIPv4())
+                      << ", Switch ID: " << sw->id() << ", port: " << in_port;
+        }
     }
     else {
         Host* h = app->getHost(host_mac);
         std::string s_ip = AppObject::uint32_t_ip_to_string(host_ip.getIPv4());
-        if (s_ip != "0.0.0.0") {
+        if (h && s_ip != "0.0.0.0") {
             h->ip(s_ip);
         }
     }
@@ -257,6 +267,7 @@ bool HostManager::isPrereq(const std::string &name) const
 
 std::unordered_map<std::string, Host*> HostManager::hosts()
 {
+    std::lock_guard<std::mutex> lk(mutex);
     return m->hosts;
 }
 
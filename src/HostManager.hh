@@ -92,9 +92,10 @@ private:
     struct HostManagerImpl* m;
     std::vector<std::string> switch_macs;
     SwitchManager* m_switch_manager;
+    // Handlers of all workers share the hosts and switch MACs
     std::mutex mutex;
 
-    void addHost(Switch* sw, IPAddress ip, std::string mac, uint32_t port);
+    bool addHost(Switch* sw, IPAddress ip, std::string mac, uint32_t port);
     Host* createHost(std::string mac, IPAddress ip);
     bool findMac(std::string mac);
     bool isSwitch(std::string mac);
@@ -224,6 +224,8 @@ LearningSwitch::findAndLearn(const switch_and_port& where,
     std::pair<bool, switch_and_port> ret;
     ret.first = false;
 
+    // Handlers of other workers may learn at the same time
+    std::lock_guard<std::mutex> lock(db_lock);
     auto it_src = db.find(eth_src);
     auto it_dst = db.find(eth_dst);
 
@@ -235,9 +237,7 @@ LearningSwitch::findAndLearn(const switch_and_port& where,
     // Learn new MAC or update old entry
     // TODO: implement migrations
     if (it_src == db.end()) {
-        db_lock.lock();
         db[eth_src] = where;
-        db_lock.unlock();
 
         LOG(INFO) << eth_src.to_string() << " seen at "
             << FORMAT_DPID << where.dpid << ':' << where.port;
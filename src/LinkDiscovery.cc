@@ -19,10 +19,13 @@
 
 #include "LinkDiscovery.hh"
 
+#include <cstring>
 #include <tins/macros.h>
 #include <fluid/util/util.h>
 #include "LLDP.hh"
 #include "Controller.hh"
+#include "MessageTemplate.hh"
+#include "SendBuffer.hh"
 
 REGISTER_APPLICATION(LinkDiscovery, {"switch-manager", "controller", ""})
 
@@ -135,6 +138,20 @@ struct lldp_packet {
     uint16_t end;
 } TINS_END_PACK;
 
+// Packet-out with a single output action followed by LLDP packet
+static of13::PacketOut lldpPacketOut()
+{
+    lldp_packet lldp;
+    memset(&lldp, 0, sizeof lldp);
+
+    of13::PacketOut po;
+    of13::OutputAction action(of13::OFPP_ANY, of13::OFPCML_NO_BUFFER);
+    po.buffer_id(OFP_NO_BUFFER);
+    po.data(&lldp, sizeof lldp);
+    po.add_action(action);
+    return po;
+}
+
 void LinkDiscovery::sendLLDP(Switch *dp, of13::Port port)
 {
     lldp_packet lldp;
@@ -168,16 +185,18 @@ void LinkDiscovery::sendLLDP(Switch *dp, of13::Port port)
     lldp.end = 0;
 
     VLOG(5) << "Sending LLDP packet to " << port.name();
-    of13::PacketOut po;
-    of13::OutputAction action(port.port_no(), of13::OFPCML_NO_BUFFER);
-    po.buffer_id(OFP_NO_BUFFER);
-    po.data(&lldp, sizeof lldp);
-    po.add_action(action);
+    static const MessageTemplate po(lldpPacketOut());
+    const size_t data_offset = po.length() - sizeof lldp;
 
     // Send packet 3 times to prevent drops
-    dp->send(&po);
-    dp->send(&po);
-    dp->send(&po);
+    SendBuffer buf;
+    for (int i = 0; i < 3; ++i) {
+        uint8_t* msg = po.copyTo(buf);
+        MessageTemplate::set32(msg, MessageTemplate::packetOutActions +
+                                    MessageTemplate::outputActionPort, port.port_no());
+        memcpy(msg + data_offset, &lldp, sizeof lldp);
+    }
+    buf.send(dp->ofconn());
 }
 
 OFMessageHandler::Action LinkDiscovery::Handler::processMiss(OFConnection *ofconn, Flow *flow)
@@ -193,12 +212,12 @@ OFMessageHandler::Action LinkDiscovery::Handler::processMiss(OFConnection *ofcon
         flow->timeToLive(0);
         flow->setFlags(Flow::Disposable);
 
-        auto pkt = flow->pkt()->serialize();
-        if (pkt.size() < sizeof lldp) {
+        Packet* pkt = flow->pkt();
+        if (pkt->size() < sizeof lldp) {
             LOG(ERROR) << "LLDP packet received is too small";
             return Stop;
         }
-        memcpy(&lldp, pkt.data(), sizeof lldp);
+        memcpy(&lldp, pkt->data(), sizeof lldp);
 
         switch_and_port source;
         switch_and_port target;
@@ -116,10 +116,15 @@ bool oxm_match(const of13::OXMTLV *tlv, const of13::OXMTLV *value)
 
 EthAddress operator&(const EthAddress &a, const EthAddress &b)
 {
-    return fluid_msg::EthAddress();
+    EthAddress a_(a), b_(b);
+    uint8_t data[6];
+    for (int i = 0; i < 6; ++i)
+        data[i] = a_.get_data()[i] & b_.get_data()[i];
+    return fluid_msg::EthAddress(data);
 }
 
 IPAddress operator&(const IPAddress &a, const IPAddress &b)
 {
-    return fluid_msg::IPAddress();
+    IPAddress a_(a), b_(b);
+    return fluid_msg::IPAddress(a_.getIPv4() & b_.getIPv4());
 }
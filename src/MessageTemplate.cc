@@ -0,0 +1,64 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MessageTemplate.hh"
+
+#include <cstring>
+#include <fluid/util/util.h>
+
+#include "SendBuffer.hh"
+
+MessageTemplate::MessageTemplate(OFMsg& msg)
+{
+    uint8_t* buf = msg.pack();
+    m_data.assign(buf, buf + msg.length());
+    OFMsg::free_buffer(buf);
+}
+
+uint8_t* MessageTemplate::copyTo(SendBuffer& buf) const
+{
+    uint8_t* ret = buf.extend(m_data.size());
+    memcpy(ret, m_data.data(), m_data.size());
+    return ret;
+}
+
+void MessageTemplate::send(OFConnection* ofconn) const
+{
+    sendToSwitch(ofconn, m_data.data(), m_data.size());
+}
+
+void MessageTemplate::set8(uint8_t* msg, size_t offset, uint8_t value)
+{
+    msg[offset] = value;
+}
+
+void MessageTemplate::set16(uint8_t* msg, size_t offset, uint16_t value)
+{
+    uint16_t value_n = hton16(value);
+    memcpy(msg + offset, &value_n, sizeof(value_n));
+}
+
+void MessageTemplate::set32(uint8_t* msg, size_t offset, uint32_t value)
+{
+    uint32_t value_n = hton32(value);
+    memcpy(msg + offset, &value_n, sizeof(value_n));
+}
+
+void MessageTemplate::set64(uint8_t* msg, size_t offset, uint64_t value)
+{
+    uint64_t value_n = hton64(value);
+    memcpy(msg + offset, &value_n, sizeof(value_n));
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Common.hh"
+
+#include <vector>
+
+class SendBuffer;
+
+/**
+ * Message packed once and copied on every send. Fields that differ
+ * between sends are patched in the copy by offset, values are converted
+ * to network byte order. Templates are immutable after construction
+ * and may be shared between threads.
+ */
+class MessageTemplate {
+public:
+    //@{
+    /// Offsets of the fields patched by the controller
+    static const size_t xidOffset = 4;
+    static const size_t flowModCookie = 8;
+    static const size_t flowModTableId = 24;
+    static const size_t flowModHardTimeout = 28;
+    static const size_t flowModBufferId = 32;
+    static const size_t flowModOutPort = 36;
+    static const size_t packetOutActions = 24;
+    static const size_t outputActionPort = 4;
+    //@}
+
+    explicit MessageTemplate(OFMsg& msg);
+    explicit MessageTemplate(OFMsg&& msg) : MessageTemplate(msg) { }
+
+    const uint8_t* data() const { return m_data.data(); }
+    size_t length() const { return m_data.size(); }
+
+    /// Copies the message to the end of the buffer, returns the copy
+    uint8_t* copyTo(SendBuffer& buf) const;
+
+    /// Sends unchanged message
+    void send(OFConnection* ofconn) const;
+
+    static void set8(uint8_t* msg, size_t offset, uint8_t value);
+    static void set16(uint8_t* msg, size_t offset, uint16_t value);
+    static void set32(uint8_t* msg, size_t offset, uint32_t value);
+    static void set64(uint8_t* msg, size_t offset, uint64_t value);
+    static void setXid(uint8_t* msg, uint32_t xid) { set32(msg, xidOffset, xid); }
+
+private:
+    std::vector<uint8_t> m_data;
+
+    MessageTemplate(const MessageTemplate&) = delete;
+    MessageTemplate& operator=(const MessageTemplate&) = delete;
+};
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MicroflowCache.hh"
+
+#include <cstring>
+#include <functional>
+
+#include "Packet.hh"
+#include "OXMTLVUnion.hh"
+
+MicroflowCache::MicroflowCache(size_t size)
+    : m_slot(64), m_hits(0), m_misses(0)
+{
+    resize(size);
+}
+
+void MicroflowCache::resize(size_t size)
+{
+    m_entries.assign(size, Entry{0, 0, 0});
+    m_keys.assign(size * m_slot, 0);
+}
+
+void MicroflowCache::clear()
+{
+    for (auto& e : m_entries) {
+        e.cookie = 0;
+        e.length = 0;
+    }
+}
+
+TraceTreeNode::LeafData* MicroflowCache::find(TraceTree& tree, Packet* pkt)
+{
+    if (m_entries.empty())
+        return tree.find(pkt);
+
+    // Packed values include field headers, so keys made for
+    // different sets of fields never match each other
+    m_key.clear();
+    tree.fields(m_fields);
+    for (uint8_t field : m_fields) {
+        OXMTLVUnion data(field);
+        pkt->read(data);
+
+        size_t off = m_key.size();
+        m_key.resize(off + 4 + data.base()->length());
+        data.base()->pack(reinterpret_cast<uint8_t*>(&m_key[off]));
+    }
+
+    size_t hash = std::hash<std::string>()(m_key);
+    size_t index = hash % m_entries.size();
+    Entry& e = m_entries[index];
+    char* key = &m_keys[index * m_slot];
+
+    if (e.cookie != 0 && e.hash == hash && e.length == m_key.size() &&
+            memcmp(key, m_key.data(), e.length) == 0) {
+        TraceTreeNode::LeafData* leaf = tree.leaf(e.cookie);
+        if (leaf) {
+            ++m_hits;
+            DVLOG(10) << "Microflow cache hit, cookie = " << e.cookie
+                      << " (" << m_hits << " hits, " << m_misses << " misses)";
+            return leaf;
+        }
+    }
+
+    ++m_misses;
+    TraceTreeNode::LeafData* leaf = tree.find(pkt);
+    if (leaf && m_key.size() > m_slot) {
+        // Tree tests more fields now, entries are relaid for longer keys
+        while (m_slot < m_key.size())
+            m_slot *= 2;
+        resize(m_entries.size());
+    }
+    if (leaf) {
+        Entry& fill = m_entries[index];
+        fill.hash = hash;
+        fill.cookie = leaf->fm->cookie();
+        fill.length = m_key.size();
+        memcpy(&m_keys[index * m_slot], m_key.data(), m_key.size());
+    }
+    return leaf;
+}
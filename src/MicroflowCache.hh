@@ -0,0 +1,65 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Common.hh"
+#include "TraceTree.hh"
+
+#include <string>
+#include <vector>
+
+class Packet;
+
+/**
+ * Exact-match cache in front of the trace tree.
+ *
+ * Key is made of all fields the tree looks at, so packets with equal
+ * keys always reach the same leaf. Entries refer to leaves by cookie,
+ * thus destroyed leaves and cleared trees never produce false hits.
+ */
+class MicroflowCache {
+public:
+    explicit MicroflowCache(size_t size = 0);
+
+    /// Sets number of entries, zero disables the cache
+    void resize(size_t size);
+
+    /**
+     * Looks up the packet in the cache and then in the tree.
+     * Remembers leaves found in the tree.
+     */
+    TraceTreeNode::LeafData* find(TraceTree& tree, Packet* pkt);
+
+    void clear();
+
+private:
+    struct Entry {
+        size_t hash;
+        uint64_t cookie;
+        size_t length;
+    };
+
+    std::vector<Entry> m_entries;
+    // Keys of all entries, m_slot bytes per entry, so filling
+    // an entry never allocates
+    std::vector<char> m_keys;
+    size_t m_slot;
+    std::string m_key;
+    std::vector<uint8_t> m_fields;
+    uint64_t m_hits;
+    uint64_t m_misses;
+};
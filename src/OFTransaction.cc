@@ -16,6 +16,8 @@
 
 #include "OFTransaction.hh"
 
+#include "SendBuffer.hh"
+
 OFTransaction::OFTransaction(uint32_t xid, QObject *parent)
     : QObject(parent), m_xid(xid)
 { }
@@ -24,6 +26,6 @@ void OFTransaction::request(OFConnection* ofconn, OFMsg *msg)
 {
     msg->xid(m_xid);
     uint8_t* buffer = msg->pack();
-    ofconn->send(buffer, msg->length());
+    sendToSwitch(ofconn, buffer, msg->length());
     delete[] buffer;
 }
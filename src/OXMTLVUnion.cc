@@ -54,12 +54,12 @@ of13::OXMTLV *OXMTLVUnion::init(uint8_t field)
         m_base = new (&arpTha) of13::ARPTHA(); break;
     case of13::OFPXMT_OFB_ARP_TPA:
         m_base = new (&arpTpa) of13::ARPTPA(); break;
-    case of13::OFPXMT_OFB_METADATA:break;
+    case of13::OFPXMT_OFB_METADATA:
         m_base = new (&metadata) of13::Metadata(); break;
-    //case of13::OFPXMT_OFB_VLAN_VID:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_VLAN_PCP:break;
-    //    m_base = new (&) of13::(); break;
+    case of13::OFPXMT_OFB_VLAN_VID:
+        m_base = new (&vlanVid) of13::VLANVid(); break;
+    case of13::OFPXMT_OFB_VLAN_PCP:
+        m_base = new (&vlanPcp) of13::VLANPcp(); break;
     case of13::OFPXMT_OFB_IP_DSCP:
         m_base = new (&ipDscp) of13::IPDSCP(); break;
     case of13::OFPXMT_OFB_IP_ECN:
@@ -70,44 +70,44 @@ of13::OXMTLV *OXMTLVUnion::init(uint8_t field)
         m_base = new (&ipv4Src) of13::IPv4Src(); break;
     case of13::OFPXMT_OFB_IPV4_DST:
         m_base = new (&ipv4Dst) of13::IPv4Dst(); break;
-    case of13::OFPXMT_OFB_TCP_SRC:break;
+    case of13::OFPXMT_OFB_TCP_SRC:
         m_base = new (&tcpSrc) of13::TCPSrc(); break;
-    case of13::OFPXMT_OFB_TCP_DST:break;
+    case of13::OFPXMT_OFB_TCP_DST:
         m_base = new (&tcpDst) of13::TCPDst(); break;
-    case of13::OFPXMT_OFB_UDP_SRC:break;
+    case of13::OFPXMT_OFB_UDP_SRC:
         m_base = new (&udpSrc) of13::UDPSrc(); break;
-    case of13::OFPXMT_OFB_UDP_DST:break;
+    case of13::OFPXMT_OFB_UDP_DST:
         m_base = new (&udpDst) of13::UDPDst(); break;
-    //case of13::OFPXMT_OFB_SCTP_SRC:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_SCTP_DST:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_ICMPV4_TYPE:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_ICMPV4_CODE:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_IPV6_SRC:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_IPV6_DST:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_IPV6_FLABEL:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_ICMPV6_TYPE:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_ICMPV6_CODE:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_IPV6_ND_TARGET:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_IPV6_ND_SLL:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_IPV6_ND_TLL:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_MPLS_LABEL:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_MPLS_TC:break;
-    //    m_base = new (&) of13::(); break;
-    //case of13::OFPXMT_OFB_MPLS_BOS:break;
-    //    m_base = new (&) of13::(); break;
+    case of13::OFPXMT_OFB_SCTP_SRC:
+        m_base = new (&sctpSrc) of13::SCTPSrc(); break;
+    case of13::OFPXMT_OFB_SCTP_DST:
+        m_base = new (&sctpDst) of13::SCTPDst(); break;
+    case of13::OFPXMT_OFB_ICMPV4_TYPE:
+        m_base = new (&icmpv4Type) of13::ICMPv4Type(); break;
+    case of13::OFPXMT_OFB_ICMPV4_CODE:
+        m_base = new (&icmpv4Code) of13::ICMPv4Code(); break;
+    case of13::OFPXMT_OFB_IPV6_SRC:
+        m_base = new (&ipv6Src) of13::IPv6Src(); break;
+    case of13::OFPXMT_OFB_IPV6_DST:
+        m_base = new (&ipv6Dst) of13::IPv6Dst(); break;
+    case of13::OFPXMT_OFB_IPV6_FLABEL:
+        m_base = new (&ipv6Flabel) of13::IPV6Flabel(); break;
+    case of13::OFPXMT_OFB_ICMPV6_TYPE:
+        m_base = new (&icmpv6Type) of13::ICMPv6Type(); break;
+    case of13::OFPXMT_OFB_ICMPV6_CODE:
+        m_base = new (&icmpv6Code) of13::ICMPv6Code(); break;
+    case of13::OFPXMT_OFB_IPV6_ND_TARGET:
+        m_base = new (&ipv6NDTarget) of13::IPv6NDTarget(); break;
+    case of13::OFPXMT_OFB_IPV6_ND_SLL:
+        m_base = new (&ipv6NDSLL) of13::IPv6NDSLL(); break;
+    case of13::OFPXMT_OFB_IPV6_ND_TLL:
+        m_base = new (&ipv6NDTLL) of13::IPv6NDTLL(); break;
+    case of13::OFPXMT_OFB_MPLS_LABEL:
+        m_base = new (&mplsLabel) of13::MPLSLabel(); break;
+    case of13::OFPXMT_OFB_MPLS_TC:
+        m_base = new (&mplsTc) of13::MPLSTC(); break;
+    case of13::OFPXMT_OFB_MPLS_BOS:
+        m_base = new (&mplsBos) of13::MPLSBOS(); break;
     //case of13::OFPXMT_OFB_PBB_ISID:break;
     //    m_base = new (&) of13::(); break;
     //case of13::OFPXMT_OFB_TUNNEL_ID:break;
@@ -14,121 +14,474 @@
  * limitations under the License.
  */
 
+
 #include "Packet.hh"
 
-#include <tins/ethernetII.h>
-#include <tins/rawpdu.h>
-#include <tins/arp.h>
-#include <tins/ip.h>
-#include <tins/tcp.h>
-#include <tins/udp.h>
+#include <cstring>
+
+#include "Arena.hh"
+#include "PacketInView.hh"
+
+static const uint16_t ethTypeIPv4 = 0x0800;
+static const uint16_t ethTypeARP = 0x0806;
+static const uint16_t ethTypeVLAN = 0x8100;
+static const uint16_t ethTypeIPv6 = 0x86dd;
+static const uint16_t ethTypeMPLS = 0x8847;
+static const uint16_t ethTypeMPLSMulticast = 0x8848;
+static const uint16_t ethTypeQinQ = 0x88a8;
+
+static const uint8_t protoICMP = 1;
+static const uint8_t protoTCP = 6;
+static const uint8_t protoUDP = 17;
+static const uint8_t protoICMPv6 = 58;
+static const uint8_t protoSCTP = 132;
+
+// IPv6 extension headers skipped while looking for the upper layer
+static const uint8_t ipv6HopByHop = 0;
+static const uint8_t ipv6Routing = 43;
+static const uint8_t ipv6Fragment = 44;
+static const uint8_t ipv6DestOptions = 60;
+
+// Neighbor discovery messages and options
+static const uint8_t ndSolicitation = 135;
+static const uint8_t ndAdvertisement = 136;
+static const uint8_t ndSourceLinkAddr = 1;
+static const uint8_t ndTargetLinkAddr = 2;
 
 struct PacketImpl {
-    of13::Match match;
-
-    Tins::EthernetII pkt;
-    Tins::ARP*       arp;
-    Tins::IP*        ip;
-    Tins::TCP*       tcp;
-    Tins::UDP*       udp;
-
-    PacketImpl(of13::PacketIn& pi)
-        : //match(pi.match()),
-          // Parse packet data
-          pkt(Tins::RawPDU(static_cast<uint8_t*>(pi.data()), pi.data_len())
-              .to<Tins::EthernetII>()),
-          arp(dynamic_cast<Tins::ARP*>(pkt.inner_pdu())),
-          ip(dynamic_cast<Tins::IP*>(pkt.inner_pdu()))
+    // Pipeline fields of the packet-in match
+    uint32_t in_port;
+    uint32_t in_phy_port;
+    uint64_t metadata;
+
+    // Not owned, points into the packet-in
+    const uint8_t* data;
+    size_t len;
+
+    enum Layer {
+        None,
+        Link,    // Ethernet, VLAN and MPLS
+        Network  // IPv4, IPv6 and offset of the transport header
+    } parsed;
+
+    // Offsets of the headers, 0 when missing or truncated
+    size_t vlan; // TCI of the outer tag
+    size_t mpls; // top label stack entry
+    size_t l3;
+    size_t l4;
+    // Type of the payload following the tags
+    uint16_t eth_type;
+    // Upper layer protocol of IPv4 or IPv6
+    uint8_t ip_proto;
+
+    PacketImpl(const PacketInView& pi)
+        : in_port(pi.in_port()), in_phy_port(pi.in_phy_port()), metadata(pi.metadata()),
+          data(pi.data()), len(pi.data_len()),
+          parsed(None), vlan(0), mpls(0), l3(0), l4(0), eth_type(0), ip_proto(0)
+    { }
+
+    bool has(size_t offset, size_t size) const
+    { return offset > 0 && offset + size <= len; }
+
+    uint8_t u8(size_t offset) const
+    { return data[offset]; }
+
+    uint16_t u16(size_t offset) const
+    { return uint16_t(data[offset] << 8 | data[offset + 1]); }
+
+    uint32_t u32(size_t offset) const
+    { return uint32_t(u16(offset)) << 16 | u16(offset + 2); }
+
+    void parse(Layer layer)
     {
-        of13::Match::swap(match, pi.match());
-        if (ip) {
-            tcp = dynamic_cast<Tins::TCP*>(ip->inner_pdu());
-            udp = dynamic_cast<Tins::UDP*>(ip->inner_pdu());
-        }
+        if (parsed >= layer)
+            return;
+        if (parsed < Link)
+            parseLink();
+        if (layer >= Network)
+            parseNetwork();
+    }
+
+    void parseLink();
+    void parseNetwork();
+
+    // Offset of the header if the packet has it
+    size_t arp()
+    {
+        parse(Link);
+        return eth_type == ethTypeARP && has(l3, 28) ? l3 : 0;
+    }
+
+    size_t ipv4()
+    {
+        parse(Network);
+        return eth_type == ethTypeIPv4 && has(l3, 20) ? l3 : 0;
+    }
+
+    size_t ipv6()
+    {
+        parse(Network);
+        return eth_type == ethTypeIPv6 && has(l3, 40) ? l3 : 0;
+    }
+
+    size_t transport(uint8_t proto, size_t size)
+    {
+        parse(Network);
+        return ip_proto == proto && has(l4, size) ? l4 : 0;
+    }
+
+    size_t icmpv4(size_t size)
+    { return ipv4() ? transport(protoICMP, size) : 0; }
+
+    size_t icmpv6(size_t size)
+    { return ipv6() ? transport(protoICMPv6, size) : 0; }
+
+    size_t ndOption(uint8_t message, uint8_t option);
+
+    EthAddress ethAddress(size_t offset) const
+    { return offset ? EthAddress(data + offset) : EthAddress(); }
+
+    IPAddress ipv4Address(size_t offset) const
+    {
+        if (offset == 0)
+            return IPAddress();
+        // IPAddress keeps IPv4 addresses in network byte order
+        uint32_t addr;
+        memcpy(&addr, data + offset, sizeof(addr));
+        return IPAddress(addr);
+    }
+
+    IPAddress ipv6Address(size_t offset) const
+    {
+        IPAddress ret;
+        if (offset == 0)
+            return ret;
+        uint8_t addr[16];
+        memcpy(addr, data + offset, sizeof(addr));
+        ret.setIPv6(addr);
+        return ret;
     }
 };
 
-Packet::Packet(of13::PacketIn& pi)
-    : m(new PacketImpl(pi))
+void PacketImpl::parseLink()
+{
+    parsed = Link;
+    if (len < 14)
+        return;
+
+    size_t offset = 12;
+    eth_type = u16(offset);
+    while ((eth_type == ethTypeVLAN || eth_type == ethTypeQinQ) && has(offset, 6)) {
+        if (vlan == 0)
+            vlan = offset + 2;
+        offset += 4;
+        eth_type = u16(offset);
+    }
+    offset += 2;
+
+    if (eth_type == ethTypeMPLS || eth_type == ethTypeMPLSMulticast) {
+        // Payload of MPLS isn't identified by the header
+        if (has(offset, 4))
+            mpls = offset;
+    } else {
+        l3 = offset;
+    }
+}
+
+void PacketImpl::parseNetwork()
+{
+    parsed = Network;
+
+    if (eth_type == ethTypeIPv4 && has(l3, 20)) {
+        size_t ihl = (u8(l3) & 0x0f) * 4;
+        ip_proto = u8(l3 + 9);
+        // Only the first fragment carries the transport header
+        if (ihl >= 20 && (u16(l3 + 6) & 0x1fff) == 0)
+            l4 = l3 + ihl;
+    } else if (eth_type == ethTypeIPv6 && has(l3, 40)) {
+        uint8_t next = u8(l3 + 6);
+        size_t offset = l3 + 40;
+        for (;;) {
+            if (next == ipv6HopByHop || next == ipv6Routing || next == ipv6DestOptions) {
+                if (not has(offset, 8))
+                    break;
+                next = u8(offset);
+                offset += (u8(offset + 1) + 1) * 8;
+            } else if (next == ipv6Fragment) {
+                if (not has(offset, 8))
+                    break;
+                next = u8(offset);
+                if (u16(offset + 2) & 0xfff8) {
+                    offset = 0;
+                    break;
+                }
+                offset += 8;
+            } else {
+                break;
+            }
+        }
+        ip_proto = next;
+        l4 = offset;
+    }
+}
+
+size_t PacketImpl::ndOption(uint8_t message, uint8_t option)
+{
+    size_t icmp = icmpv6(24);
+    if (icmp == 0 || u8(icmp) != message)
+        return 0;
+
+    for (size_t offset = icmp + 24; has(offset, 8); ) {
+        size_t size = u8(offset + 1) * 8;
+        if (size == 0)
+            break;
+        if (u8(offset) == option)
+            return offset + 2;
+        offset += size;
+    }
+    return 0;
+}
+
+Packet::Packet(const PacketInView& pi, Arena& arena)
+    : m(arena.make<PacketImpl>(pi))
 { }
 
 Packet::~Packet()
-{ delete m; }
+{
+    // PacketImpl is released with the arena
+}
 
 std::vector<uint8_t> Packet::serialize() const
 {
-    return m->pkt.serialize();
+    return std::vector<uint8_t>(m->data, m->data + m->len);
 }
 
-inline static EthAddress convert(const Tins::HWAddress<6> &hw_addr)
-{ return EthAddress(hw_addr.begin()); }
+const uint8_t* Packet::data() const
+{ return m->data; }
 
-inline static IPAddress convert(const Tins::IPv4Address &ip_addr)
-{ return IPAddress(ip_addr); }
+size_t Packet::size() const
+{ return m->len; }
 
 // OpenFlow
 uint32_t Packet::readInPort()
-{ return m->match.in_port() ? m->match.in_port()->value() : of13::OFPP_ANY; }
+{ return m->in_port; }
 
 uint32_t Packet::readInPhyPort()
-{ return m->match.in_phy_port() ? m->match.in_phy_port()->value() : of13::OFPP_ANY; }
+{ return m->in_phy_port; }
 
 uint64_t Packet::readMetadata()
-{ return m->match.metadata() ? m->match.metadata()->value() : 0; }
+{ return m->metadata; }
 
 // Ethernet
 EthAddress Packet::readEthSrc()
-{ return convert(m->pkt.src_addr()); }
+{ return m->ethAddress(m->has(6, 6) ? 6 : 0); }
 
 EthAddress Packet::readEthDst()
-{ return convert(m->pkt.dst_addr()); }
+{ return m->len >= 6 ? EthAddress(m->data) : EthAddress(); }
 
 uint16_t Packet::readEthType()
-{ return m->pkt.payload_type(); }
+{
+    m->parse(PacketImpl::Link);
+    return m->eth_type;
+}
+
+// VLAN
+uint16_t Packet::readVLANVid()
+{
+    m->parse(PacketImpl::Link);
+    return m->vlan ? (of13::OFPVID_PRESENT | (m->u16(m->vlan) & 0x0fff)) : 0;
+}
+
+uint8_t Packet::readVLANPcp()
+{
+    m->parse(PacketImpl::Link);
+    return m->vlan ? m->u8(m->vlan) >> 5 : 0;
+}
+
+// MPLS
+uint32_t Packet::readMPLSLabel()
+{
+    m->parse(PacketImpl::Link);
+    return m->mpls ? m->u32(m->mpls) >> 12 : 0;
+}
+
+uint8_t Packet::readMPLSTC()
+{
+    m->parse(PacketImpl::Link);
+    return m->mpls ? (m->u8(m->mpls + 2) >> 1) & 0x7 : 0;
+}
+
+uint8_t Packet::readMPLSBOS()
+{
+    m->parse(PacketImpl::Link);
+    return m->mpls ? m->u8(m->mpls + 2) & 0x1 : 0;
+}
 
 // ARP
 uint16_t Packet::readARPOp()
-{ return m->arp ? m->arp->opcode() : 0; }
+{
+    size_t arp = m->arp();
+    return arp ? m->u16(arp + 6) : 0;
+}
 
 IPAddress Packet::readARPSPA()
-{ return m->arp ? convert(m->arp->sender_ip_addr()) : IPAddress(); }
+{
+    size_t arp = m->arp();
+    return m->ipv4Address(arp ? arp + 14 : 0);
+}
 
 EthAddress Packet::readARPSHA()
-{ return m->arp ? convert(m->arp->sender_hw_addr()) : EthAddress(); }
+{
+    size_t arp = m->arp();
+    return m->ethAddress(arp ? arp + 8 : 0);
+}
 
 EthAddress Packet::readARPTHA()
-{ return m->arp ? convert(m->arp->target_hw_addr()) : EthAddress(); }
+{
+    size_t arp = m->arp();
+    return m->ethAddress(arp ? arp + 18 : 0);
+}
 
 IPAddress Packet::readARPTPA()
-{ return m->arp ? convert(m->arp->target_ip_addr()) : IPAddress(); }
+{
+    size_t arp = m->arp();
+    return m->ipv4Address(arp ? arp + 24 : 0);
+}
 
 // IP
 IPAddress Packet::readIPv4Src()
-{ return m->ip ? convert(m->ip->src_addr()) : IPAddress(); }
+{
+    size_t ip = m->ipv4();
+    return m->ipv4Address(ip ? ip + 12 : 0);
+}
 
 IPAddress Packet::readIPv4Dst()
-{ return m->ip ? convert(m->ip->dst_addr()) : IPAddress(); }
+{
+    size_t ip = m->ipv4();
+    return m->ipv4Address(ip ? ip + 16 : 0);
+}
+
+// Traffic class of IPv6 has the same layout as TOS of IPv4
+static uint8_t readTOS(PacketImpl* m)
+{
+    if (size_t ip = m->ipv4())
+        return m->u8(ip + 1);
+    if (size_t ip = m->ipv6())
+        return (m->u16(ip) >> 4) & 0xff;
+    return 0;
+}
 
 uint8_t Packet::readIPDSCP()
-{ return m->ip ? (m->ip->tos() >> 2) : 0; }
+{ return readTOS(m) >> 2; }
 
 uint8_t Packet::readIPECN()
-{ return m->ip ? (m->ip->tos() & 0x3) : 0; }
+{ return readTOS(m) & 0x3; }
 
 uint8_t Packet::readIPProto()
-{ return m->ip ? m->ip->protocol() : 0; }
+{
+    m->parse(PacketImpl::Network);
+    return m->ip_proto;
+}
+
+// IPv6
+IPAddress Packet::readIPv6Src()
+{
+    size_t ip = m->ipv6();
+    return m->ipv6Address(ip ? ip + 8 : 0);
+}
+
+IPAddress Packet::readIPv6Dst()
+{
+    size_t ip = m->ipv6();
+    return m->ipv6Address(ip ? ip + 24 : 0);
+}
+
+uint32_t Packet::readIPv6Flabel()
+{
+    size_t ip = m->ipv6();
+    return ip ? m->u32(ip) & 0xfffff : 0;
+}
+
+IPAddress Packet::readIPv6NDTarget()
+{
+    size_t icmp = m->icmpv6(24);
+    bool nd = icmp && (m->u8(icmp) == ndSolicitation || m->u8(icmp) == ndAdvertisement);
+    return m->ipv6Address(nd ? icmp + 8 : 0);
+}
+
+EthAddress Packet::readIPv6NDSLL()
+{
+    size_t option = m->ndOption(ndSolicitation, ndSourceLinkAddr);
+    return m->ethAddress(option);
+}
+
+EthAddress Packet::readIPv6NDTLL()
+{
+    size_t option = m->ndOption(ndAdvertisement, ndTargetLinkAddr);
+    return m->ethAddress(option);
+}
 
+// Transport
 uint16_t Packet::readTCPSrc()
-{ return m->tcp ? m->tcp->sport() : 0; }
+{
+    size_t tcp = m->transport(protoTCP, 4);
+    return tcp ? m->u16(tcp) : 0;
+}
 
 uint16_t Packet::readTCPDst()
-{ return m->tcp ? m->tcp->dport() : 0; }
+{
+    size_t tcp = m->transport(protoTCP, 4);
+    return tcp ? m->u16(tcp + 2) : 0;
+}
 
 uint16_t Packet::readUDPSrc()
-{ return m->udp ? m->udp->sport() : 0; }
+{
+    size_t udp = m->transport(protoUDP, 4);
+    return udp ? m->u16(udp) : 0;
+}
 
 uint16_t Packet::readUDPDst()
-{ return m->udp ? m->udp->dport() : 0; }
+{
+    size_t udp = m->transport(protoUDP, 4);
+    return udp ? m->u16(udp + 2) : 0;
+}
+
+uint16_t Packet::readSCTPSrc()
+{
+    size_t sctp = m->transport(protoSCTP, 4);
+    return sctp ? m->u16(sctp) : 0;
+}
+
+uint16_t Packet::readSCTPDst()
+{
+    size_t sctp = m->transport(protoSCTP, 4);
+    return sctp ? m->u16(sctp + 2) : 0;
+}
+
+// ICMP
+uint8_t Packet::readICMPv4Type()
+{
+    size_t icmp = m->icmpv4(2);
+    return icmp ? m->u8(icmp) : 0;
+}
+
+uint8_t Packet::readICMPv4Code()
+{
+    size_t icmp = m->icmpv4(2);
+    return icmp ? m->u8(icmp + 1) : 0;
+}
+
+uint8_t Packet::readICMPv6Type()
+{
+    size_t icmp = m->icmpv6(2);
+    return icmp ? m->u8(icmp) : 0;
+}
+
+uint8_t Packet::readICMPv6Code()
+{
+    size_t icmp = m->icmpv6(2);
+    return icmp ? m->u8(icmp + 1) : 0;
+}
 
 void Packet::read(of13::OXMTLV& tlv)
 {
@@ -155,8 +508,10 @@ void Packet::read(of13::OXMTLV& tlv)
         tlv = of13::ARPTPA(readARPTPA()); break;
     case of13::OFPXMT_OFB_METADATA:
         tlv = of13::Metadata(readMetadata()); break;
-    case of13::OFPXMT_OFB_VLAN_VID:break;
-    case of13::OFPXMT_OFB_VLAN_PCP:break;
+    case of13::OFPXMT_OFB_VLAN_VID:
+        tlv = of13::VLANVid(readVLANVid()); break;
+    case of13::OFPXMT_OFB_VLAN_PCP:
+        tlv = of13::VLANPcp(readVLANPcp()); break;
     case of13::OFPXMT_OFB_IP_DSCP:
         tlv = of13::IPDSCP(readIPDSCP()); break;
     case of13::OFPXMT_OFB_IP_ECN:
@@ -167,34 +522,46 @@ void Packet::read(of13::OXMTLV& tlv)
         tlv = of13::IPv4Src(readIPv4Src()); break;
     case of13::OFPXMT_OFB_IPV4_DST:
         tlv = of13::IPv4Dst(readIPv4Dst()); break;
-    case of13::OFPXMT_OFB_TCP_SRC:break;
+    case of13::OFPXMT_OFB_TCP_SRC:
         tlv = of13::TCPSrc(readTCPSrc()); break;
-    case of13::OFPXMT_OFB_TCP_DST:break;
+    case of13::OFPXMT_OFB_TCP_DST:
         tlv = of13::TCPDst(readTCPDst()); break;
-    case of13::OFPXMT_OFB_UDP_SRC:break;
+    case of13::OFPXMT_OFB_UDP_SRC:
         tlv = of13::UDPSrc(readUDPSrc()); break;
-    case of13::OFPXMT_OFB_UDP_DST:break;
+    case of13::OFPXMT_OFB_UDP_DST:
         tlv = of13::UDPDst(readUDPDst()); break;
-    case of13::OFPXMT_OFB_SCTP_SRC:break;
-    case of13::OFPXMT_OFB_SCTP_DST:break;
-    case of13::OFPXMT_OFB_ICMPV4_TYPE:break;
-    case of13::OFPXMT_OFB_ICMPV4_CODE:break;
-    case of13::OFPXMT_OFB_IPV6_SRC:break;
-    case of13::OFPXMT_OFB_IPV6_DST:break;
-    case of13::OFPXMT_OFB_IPV6_FLABEL:break;
-    case of13::OFPXMT_OFB_ICMPV6_TYPE:break;
-    case of13::OFPXMT_OFB_ICMPV6_CODE:break;
-    case of13::OFPXMT_OFB_IPV6_ND_TARGET:break;
-    case of13::OFPXMT_OFB_IPV6_ND_SLL:break;
-    case of13::OFPXMT_OFB_IPV6_ND_TLL:break;
-    case of13::OFPXMT_OFB_MPLS_LABEL:break;
-    case of13::OFPXMT_OFB_MPLS_TC:break;
-    case of13::OFPXMT_OFB_MPLS_BOS:break;
-    case of13::OFPXMT_OFB_PBB_ISID:break;
-    case of13::OFPXMT_OFB_TUNNEL_ID:break;
-    case of13::OFPXMT_OFB_IPV6_EXTHDR:break;
+    case of13::OFPXMT_OFB_SCTP_SRC:
+        tlv = of13::SCTPSrc(readSCTPSrc()); break;
+    case of13::OFPXMT_OFB_SCTP_DST:
+        tlv = of13::SCTPDst(readSCTPDst()); break;
+    case of13::OFPXMT_OFB_ICMPV4_TYPE:
+        tlv = of13::ICMPv4Type(readICMPv4Type()); break;
+    case of13::OFPXMT_OFB_ICMPV4_CODE:
+        tlv = of13::ICMPv4Code(readICMPv4Code()); break;
+    case of13::OFPXMT_OFB_IPV6_SRC:
+        tlv = of13::IPv6Src(readIPv6Src()); break;
+    case of13::OFPXMT_OFB_IPV6_DST:
+        tlv = of13::IPv6Dst(readIPv6Dst()); break;
+    case of13::OFPXMT_OFB_IPV6_FLABEL:
+        tlv = of13::IPV6Flabel(readIPv6Flabel()); break;
+    case of13::OFPXMT_OFB_ICMPV6_TYPE:
+        tlv = of13::ICMPv6Type(readICMPv6Type()); break;
+    case of13::OFPXMT_OFB_ICMPV6_CODE:
+        tlv = of13::ICMPv6Code(readICMPv6Code()); break;
+    case of13::OFPXMT_OFB_IPV6_ND_TARGET:
+        tlv = of13::IPv6NDTarget(readIPv6NDTarget()); break;
+    case of13::OFPXMT_OFB_IPV6_ND_SLL:
+        tlv = of13::IPv6NDSLL(readIPv6NDSLL()); break;
+    case of13::OFPXMT_OFB_IPV6_ND_TLL:
+        tlv = of13::IPv6NDTLL(readIPv6NDTLL()); break;
+    case of13::OFPXMT_OFB_MPLS_LABEL:
+        tlv = of13::MPLSLabel(readMPLSLabel()); break;
+    case of13::OFPXMT_OFB_MPLS_TC:
+        tlv = of13::MPLSTC(readMPLSTC()); break;
+    case of13::OFPXMT_OFB_MPLS_BOS:
+        tlv = of13::MPLSBOS(readMPLSBOS()); break;
     default:
-        LOG(ERROR) << "Unsupported OXM TLV field: " << tlv.field();
+        LOG(ERROR) << "Unsupported OXM TLV field: " << int(tlv.field());
     }
 }
 
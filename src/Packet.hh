@@ -21,13 +21,21 @@
 #include "Common.hh"
 #include "OXMTLVUnion.hh"
 
+class Arena;
+class PacketInView;
+
 /**
  * Wraps a packet received from the switch and allows
  * to read and modify OXM fields on it.
+ *
+ * Packet data isn't copied, so the packet shouldn't outlive
+ * the packet-in message. Headers are parsed on the first access
+ * to their fields.
  */
 class Packet {
 public:
-    explicit Packet(of13::PacketIn& pi);
+    /// Keeps parsed data in the arena, packet should be freed by it too
+    Packet(const PacketInView& pi, Arena& arena);
     ~Packet();
 
     /*
@@ -51,6 +59,8 @@ public:
      * Raw packet data clipped to miss_send_len.
      */
     std::vector<uint8_t> serialize() const;
+    const uint8_t* data() const;
+    size_t size() const;
 
     //@{
     /*
@@ -65,6 +75,13 @@ public:
     EthAddress        readEthSrc();
     EthAddress        readEthDst();
     uint16_t          readEthType();
+    // VLAN, outer tag
+    uint16_t          readVLANVid();
+    uint8_t           readVLANPcp();
+    // MPLS, top label
+    uint32_t          readMPLSLabel();
+    uint8_t           readMPLSTC();
+    uint8_t           readMPLSBOS();
     // ARP
     uint16_t          readARPOp();
     IPAddress         readARPSPA();
@@ -77,12 +94,27 @@ public:
     uint8_t           readIPDSCP();
     uint8_t           readIPECN();
     uint8_t           readIPProto();
+    // IPv6
+    IPAddress         readIPv6Src();
+    IPAddress         readIPv6Dst();
+    uint32_t          readIPv6Flabel();
+    IPAddress         readIPv6NDTarget();
+    EthAddress        readIPv6NDSLL();
+    EthAddress        readIPv6NDTLL();
     // TCP
     uint16_t          readTCPSrc();
     uint16_t          readTCPDst();
     // UDP
     uint16_t          readUDPSrc();
     uint16_t          readUDPDst();
+    // SCTP
+    uint16_t          readSCTPSrc();
+    uint16_t          readSCTPDst();
+    // ICMP
+    uint8_t           readICMPv4Type();
+    uint8_t           readICMPv4Code();
+    uint8_t           readICMPv6Type();
+    uint8_t           readICMPv6Code();
     // TODO: fill all possible OXM fields implemented by fluid_msg
     //@
 
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "PacketInView.hh"
+
+#include <cstring>
+#include <fluid/util/util.h>
+
+// struct ofp_packet_in up to the match, then the match header
+static const size_t matchOffset = 24;
+static const size_t matchHeaderLength = 4;
+// Data follows the match padded to 8 bytes and 2 bytes of padding
+static const size_t dataPadding = 2;
+static const size_t oxmHeaderLength = 4;
+
+template<class T>
+static T load(const uint8_t* p)
+{
+    T ret;
+    memcpy(&ret, p, sizeof(ret));
+    return ret;
+}
+
+PacketInView::PacketInView()
+    : m_xid(0), m_buffer_id(OFP_NO_BUFFER), m_total_len(0), m_reason(0),
+      m_table_id(0), m_cookie(0), m_in_port(of13::OFPP_ANY),
+      m_in_phy_port(of13::OFPP_ANY), m_metadata(0),
+      m_data(nullptr), m_data_len(0)
+{ }
+
+bool PacketInView::parse(const uint8_t* buffer, size_t len)
+{
+    if (len < matchOffset + matchHeaderLength)
+        return false;
+    size_t length = ntoh16(load<uint16_t>(buffer + 2));
+    if (length > len)
+        return false;
+
+    m_xid = ntoh32(load<uint32_t>(buffer + 4));
+    m_buffer_id = ntoh32(load<uint32_t>(buffer + 8));
+    m_total_len = ntoh16(load<uint16_t>(buffer + 12));
+    m_reason = buffer[14];
+    m_table_id = buffer[15];
+    m_cookie = ntoh64(load<uint64_t>(buffer + 16));
+
+    size_t match_len = ntoh16(load<uint16_t>(buffer + matchOffset + 2));
+    size_t data_offset = matchOffset + (match_len + 7) / 8 * 8 + dataPadding;
+    if (match_len < matchHeaderLength || data_offset > length)
+        return false;
+
+    const uint8_t* oxm = buffer + matchOffset + matchHeaderLength;
+    const uint8_t* end = buffer + matchOffset + match_len;
+    while (oxm + oxmHeaderLength <= end) {
+        uint32_t header = ntoh32(load<uint32_t>(oxm));
+        uint8_t field = (header >> 9) & 0x7f;
+        uint8_t oxm_len = header & 0xff;
+        const uint8_t* value = oxm + oxmHeaderLength;
+        if (value + oxm_len > end)
+            return false;
+
+        if ((header >> 16) == of13::OFPXMC_OPENFLOW_BASIC) {
+            switch (field) {
+            case of13::OFPXMT_OFB_IN_PORT:
+                if (oxm_len >= 4)
+                    m_in_port = ntoh32(load<uint32_t>(value));
+                break;
+            case of13::OFPXMT_OFB_IN_PHY_PORT:
+                if (oxm_len >= 4)
+                    m_in_phy_port = ntoh32(load<uint32_t>(value));
+                break;
+            case of13::OFPXMT_OFB_METADATA:
+                if (oxm_len >= 8)
+                    m_metadata = ntoh64(load<uint64_t>(value));
+                break;
+            default:
+                break;
+            }
+        }
+        oxm = value + oxm_len;
+    }
+
+    m_data = buffer + data_offset;
+    m_data_len = length - data_offset;
+    return true;
+}
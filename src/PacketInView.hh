@@ -0,0 +1,63 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "Common.hh"
+
+/**
+ * Fields of OpenFlow 1.3 packet-in read directly from the wire buffer.
+ * Unlike of13::PacketIn nothing is unpacked or copied, so the view is
+ * valid while the buffer is. Accessors are named after of13::PacketIn.
+ */
+class PacketInView {
+public:
+    PacketInView();
+
+    /// @return false when the message is malformed
+    bool parse(const uint8_t* buffer, size_t len);
+
+    uint32_t xid() const { return m_xid; }
+    uint32_t buffer_id() const { return m_buffer_id; }
+    uint16_t total_len() const { return m_total_len; }
+    uint8_t reason() const { return m_reason; }
+    uint8_t table_id() const { return m_table_id; }
+    uint64_t cookie() const { return m_cookie; }
+
+    //@{
+    /// Pipeline fields of the match, OFPP_ANY or 0 when missing
+    uint32_t in_port() const { return m_in_port; }
+    uint32_t in_phy_port() const { return m_in_phy_port; }
+    uint64_t metadata() const { return m_metadata; }
+    //@}
+
+    const uint8_t* data() const { return m_data; }
+    size_t data_len() const { return m_data_len; }
+
+private:
+    uint32_t m_xid;
+    uint32_t m_buffer_id;
+    uint16_t m_total_len;
+    uint8_t m_reason;
+    uint8_t m_table_id;
+    uint64_t m_cookie;
+    uint32_t m_in_port;
+    uint32_t m_in_phy_port;
+    uint64_t m_metadata;
+    const uint8_t* m_data;
+    size_t m_data_len;
+};
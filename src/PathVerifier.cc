@@ -5,6 +5,7 @@ REGISTER_APPLICATION(PathVerifier, {"controller", "link-discovery", "switch-mana
 void PathVerifier::init(Loader* loader, const Config& config)
 {
     sm = SwitchManager::get(loader);
+    ctrl = Controller::get(loader);
     QObject* ld = ILinkDiscovery::get(loader);
     QObject::connect(ld, SIGNAL(linkBroken(switch_and_port, switch_and_port)),
                      this, SLOT(onLinkBroken(switch_and_port, switch_and_port)));
@@ -23,25 +24,14 @@ Route* PathVerifier::findRoute(std::string src, std::string dst)
     return NULL;
 }
 
-static const uint64_t flowCookieBase = 0x100000000UL;
-static const uint64_t flowCookieMask = 0xffffffff00000000UL;
-
 void PathVerifier::removeFlows(switch_and_port sp)
 {
-    Switch* sw = sm->getSwitch(sp.dpid);
-    if (sw->ofconn()) {
-        of13::FlowMod fm;
-        fm.cookie(flowCookieBase);
-        fm.cookie_mask(flowCookieMask);
-        fm.table_id(1);
-        fm.command(of13::OFPFC_DELETE);
-        fm.out_port(of13::OFPP_ANY);
-        fm.out_group(of13::OFPG_ANY);
-
-        uint8_t* buf = fm.pack();
-        sw->ofconn()->send(buf, fm.length());
-        OFMsg::free_buffer(buf);
-    }
+    // Rules of destroyed flows are dropped by the full rebuild. Deleting
+    // them by cookie would take barriers away too, and incremental
+    // updates never send the barriers again.
+    TraceTree* trace_tree = ctrl->getTraceTree(sp.dpid);
+    if (trace_tree)
+        trace_tree->invalidateFlowTable();
 }
 
 void PathVerifier::onLinkBroken(switch_and_port from, switch_and_port to)
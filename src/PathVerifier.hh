@@ -24,6 +24,7 @@ public:
     void init(Loader* loader, const Config& config) override;
 private:
     SwitchManager* sm;
+    Controller* ctrl;
 
     std::vector<Route*> routes;
     Route* findRoute(std::string src, std::string dst);
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PendingMisses.hh"
+
+#include <cstring>
+
+PendingMisses::PendingMisses()
+    : m_head(0), m_bytes(0), m_dropped(0)
+{ }
+
+void PendingMisses::resize(size_t bytes)
+{
+    clear();
+    m_ring.assign(bytes, 0);
+    m_ring.shrink_to_fit();
+}
+
+void PendingMisses::install(uint64_t cookie)
+{
+    if (enabled() && m_installing.insert(cookie).second)
+        m_unsealed.push_back(cookie);
+}
+
+bool PendingMisses::installing(uint64_t cookie) const
+{
+    return m_installing.count(cookie) > 0;
+}
+
+bool PendingMisses::seal()
+{
+    if (m_unsealed.empty())
+        return false;
+    m_sealed.push_back(std::move(m_unsealed));
+    m_unsealed.clear();
+    return true;
+}
+
+void PendingMisses::park(uint64_t cookie, uint32_t xid, uint32_t buffer_id, uint32_t in_port,
+                         const uint8_t* data, size_t data_len)
+{
+    size_t offset = m_head;
+    if (data_len > 0) {
+        if (not reserve(data_len, offset)) {
+            ++m_dropped;
+            return;
+        }
+        memcpy(&m_ring[offset], data, data_len);
+        m_head = offset + data_len;
+        m_bytes += data_len;
+    }
+    m_entries.push_back(Entry{ cookie, xid, buffer_id, in_port, offset, data_len, false });
+}
+
+bool PendingMisses::reserve(size_t len, size_t& offset)
+{
+    size_t size = m_ring.size();
+    if (len > size)
+        return false;
+
+    for (;;) {
+        if (m_bytes == 0) {
+            offset = (m_head + len <= size) ? m_head : 0;
+            return true;
+        }
+
+        // Payloads occupy [front, head) possibly wrapped around the end
+        size_t front = 0;
+        for (const Entry& e : m_entries) {
+            if (e.len > 0) {
+                front = e.offset;
+                break;
+            }
+        }
+        if (m_head > front) {
+            if (size - m_head >= len) {
+                offset = m_head;
+                return true;
+            }
+            if (front >= len) {
+                offset = 0;
+                return true;
+            }
+        } else if (front - m_head >= len) {
+            offset = m_head;
+            return true;
+        }
+
+        // Oldest packet is lost
+        if (not m_entries.front().released)
+            ++m_dropped;
+        popFront();
+    }
+}
+
+void PendingMisses::popFront()
+{
+    m_bytes -= m_entries.front().len;
+    m_entries.pop_front();
+    if (m_bytes == 0)
+        m_head = 0;
+}
+
+void PendingMisses::clear()
+{
+    m_head = 0;
+    m_bytes = 0;
+    m_entries.clear();
+    m_installing.clear();
+    m_unsealed.clear();
+    m_sealed.clear();
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Common.hh"
+
+#include <deque>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Table misses of flows whose rules are being installed. Packets of
+ * such flows are parked instead of being handled again and released
+ * as packet-outs once the switch confirms the rules. Payloads of
+ * unbuffered packets are copied to a ring; when it overflows, the
+ * oldest parked packets are dropped as a full switch buffer would do.
+ *
+ * Flows are identified by cookies of their trace tree leaves.
+ */
+class PendingMisses {
+public:
+    struct Parked {
+        uint64_t cookie;
+        uint32_t xid;
+        uint32_t buffer_id;
+        uint32_t in_port;
+        const uint8_t* data;
+        size_t data_len;
+    };
+
+    PendingMisses();
+
+    /// Ring size in bytes, 0 disables parking
+    void resize(size_t bytes);
+    bool enabled() const { return not m_ring.empty(); }
+
+    /// Rules of the flow are being sent to the switch
+    void install(uint64_t cookie);
+    bool installing(uint64_t cookie) const;
+
+    /**
+     * Groups flows passed to install() since the last call. Groups are
+     * confirmed in the same order by release().
+     * @return False if there is nothing to confirm.
+     */
+    bool seal();
+
+    /// Parks the packet, payload is copied
+    void park(uint64_t cookie, uint32_t xid, uint32_t buffer_id, uint32_t in_port,
+              const uint8_t* data, size_t data_len);
+
+    /**
+     * Rules of the oldest sealed group are installed. Calls `f` for every
+     * packet parked by flows of the group, payloads are valid during the call.
+     */
+    template<class F>
+    void release(F f);
+
+    void clear();
+
+    /// Parked packets dropped because the ring was full
+    uint64_t dropped() const { return m_dropped; }
+
+private:
+    struct Entry {
+        uint64_t cookie;
+        uint32_t xid;
+        uint32_t buffer_id;
+        uint32_t in_port;
+        size_t offset;
+        size_t len;
+        bool released;
+    };
+
+    std::vector<uint8_t> m_ring;
+    // Offset of the next payload
+    size_t m_head;
+    // Payload bytes of the entries
+    size_t m_bytes;
+    std::deque<Entry> m_entries;
+
+    std::unordered_set<uint64_t> m_installing;
+    std::vector<uint64_t> m_unsealed;
+    std::deque<std::vector<uint64_t>> m_sealed;
+    uint64_t m_dropped;
+
+    bool reserve(size_t len, size_t& offset);
+    void popFront();
+};
+
+template<class F>
+void PendingMisses::release(F f)
+{
+    if (m_sealed.empty())
+        return;
+
+    std::vector<uint64_t> group = std::move(m_sealed.front());
+    m_sealed.pop_front();
+
+    std::unordered_set<uint64_t> cookies;
+    for (uint64_t cookie : group) {
+        m_installing.erase(cookie);
+        cookies.insert(cookie);
+    }
+
+    for (Entry& e : m_entries) {
+        if (e.released || not cookies.count(e.cookie))
+            continue;
+        f(Parked{ e.cookie, e.xid, e.buffer_id, e.in_port,
+                  e.len ? &m_ring[e.offset] : nullptr, e.len });
+        e.released = true;
+    }
+
+    while (not m_entries.empty() && m_entries.front().released)
+        popFront();
+}
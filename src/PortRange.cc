@@ -0,0 +1,94 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PortRange.hh"
+
+#include <cstring>
+#include <fluid/util/util.h>
+
+MaskedPort::MaskedPort(uint8_t field, uint16_t value, uint16_t mask)
+    : of13::OXMTLV(of13::OFPXMC_OPENFLOW_BASIC, field, true, 4),
+      m_value(value & mask), m_mask(mask)
+{ }
+
+bool MaskedPort::equals(const of13::OXMTLV& other)
+{
+    const MaskedPort* port = dynamic_cast<const MaskedPort*>(&other);
+    return port && port->field() == field() &&
+           port->m_value == m_value && port->m_mask == m_mask;
+}
+
+MaskedPort* MaskedPort::clone() const
+{
+    return new MaskedPort(*this);
+}
+
+size_t MaskedPort::pack(uint8_t* buffer)
+{
+    uint32_t header = hton32((uint32_t(class_()) << 16) | (field() << 9) | (1 << 8) | 4);
+    uint16_t value = hton16(m_value);
+    uint16_t mask = hton16(m_mask);
+
+    memcpy(buffer, &header, 4);
+    memcpy(buffer + 4, &value, 2);
+    memcpy(buffer + 6, &mask, 2);
+    return 0;
+}
+
+of_error MaskedPort::unpack(uint8_t* buffer)
+{
+    uint16_t value, mask;
+    memcpy(&value, buffer + 4, 2);
+    memcpy(&mask, buffer + 6, 2);
+    m_value = ntoh16(value);
+    m_mask = ntoh16(mask);
+    return 0;
+}
+
+std::vector<of13::OXMTLV*> expandPortRange(uint8_t field, uint16_t lo, uint16_t hi)
+{
+    std::vector<of13::OXMTLV*> ret;
+
+    // Take the largest aligned block starting at lo that fits the range
+    uint32_t l = lo;
+    while (l <= hi) {
+        uint32_t size = (l == 0) ? 0x10000 : (l & -l);
+        while (l + size - 1 > hi)
+            size >>= 1;
+
+        ret.push_back(new MaskedPort(field, l, ~(size - 1)));
+        l += size;
+    }
+
+    return ret;
+}
+
+uint16_t portValue(const of13::OXMTLV* tlv)
+{
+    switch (tlv->field()) {
+    case of13::OFPXMT_OFB_TCP_SRC:
+        return SMART_CAST<const of13::TCPSrc*>(tlv)->value();
+    case of13::OFPXMT_OFB_TCP_DST:
+        return SMART_CAST<const of13::TCPDst*>(tlv)->value();
+    case of13::OFPXMT_OFB_UDP_SRC:
+        return SMART_CAST<const of13::UDPSrc*>(tlv)->value();
+    case of13::OFPXMT_OFB_UDP_DST:
+        return SMART_CAST<const of13::UDPDst*>(tlv)->value();
+    default:
+        LOG(FATAL) << "Field " << (int) tlv->field() << " is not a port";
+        return 0;
+    }
+}
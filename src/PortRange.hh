@@ -0,0 +1,53 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Common.hh"
+
+#include <vector>
+
+/**
+ * TCP or UDP port with a bitwise mask.
+ * OpenFlow 1.3 defines L4 ports as non-maskable, so rules with these
+ * values are accepted only by switches supporting the extension
+ * (e.g. Open vSwitch).
+ */
+class MaskedPort : public of13::OXMTLV {
+public:
+    MaskedPort(uint8_t field, uint16_t value, uint16_t mask);
+
+    uint16_t value() const { return m_value; }
+    uint16_t mask() const { return m_mask; }
+
+    bool equals(const of13::OXMTLV& other) override;
+    MaskedPort* clone() const override;
+    size_t pack(uint8_t* buffer) override;
+    of_error unpack(uint8_t* buffer) override;
+
+private:
+    uint16_t m_value;
+    uint16_t m_mask;
+};
+
+/**
+ * Splits the range [lo, hi] into the minimal set of masked values.
+ * Full range gives the single value with zero mask.
+ */
+std::vector<of13::OXMTLV*> expandPortRange(uint8_t field, uint16_t lo, uint16_t hi);
+
+/// Reads port number from the TCP or UDP OXM value
+uint16_t portValue(const of13::OXMTLV* tlv);
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PrefixSet.hh"
+
+#include <arpa/inet.h>
+
+static uint32_t prefixMask(uint8_t length)
+{
+    return length == 0 ? 0 : ~0u << (32 - length);
+}
+
+PrefixSet::PrefixSet(uint8_t field)
+    : m_field(field)
+{
+    CHECK(field == of13::OFPXMT_OFB_IPV4_SRC || field == of13::OFPXMT_OFB_IPV4_DST);
+    m_trie.push_back(TrieNode{{-1, -1}, -1});
+}
+
+PrefixSet::PrefixSet(const PrefixSet& other)
+    : m_field(other.m_field), m_prefixes(other.m_prefixes), m_trie(other.m_trie)
+{
+    for (auto& p : m_prefixes)
+        p.tlv = p.tlv->clone();
+}
+
+PrefixSet::~PrefixSet()
+{
+    for (auto& p : m_prefixes)
+        delete p.tlv;
+}
+
+int PrefixSet::add(IPAddress addr, uint8_t length)
+{
+    CHECK_LE(length, 32);
+    uint32_t mask = prefixMask(length);
+    uint32_t value = ntohl(addr.getIPv4()) & mask;
+
+    size_t node = 0;
+    for (uint8_t i = 0; i < length; ++i) {
+        int bit = (value >> (31 - i)) & 1;
+        if (m_trie[node].child[bit] < 0) {
+            m_trie[node].child[bit] = m_trie.size();
+            m_trie.push_back(TrieNode{{-1, -1}, -1});
+        }
+        node = m_trie[node].child[bit];
+    }
+
+    if (m_trie[node].prefix >= 0)
+        return m_trie[node].prefix;
+
+    IPAddress value_addr(htonl(value));
+    IPAddress mask_addr(htonl(mask));
+    of13::OXMTLV* tlv;
+    if (m_field == of13::OFPXMT_OFB_IPV4_SRC)
+        tlv = new of13::IPv4Src(value_addr, mask_addr);
+    else
+        tlv = new of13::IPv4Dst(value_addr, mask_addr);
+
+    m_trie[node].prefix = m_prefixes.size();
+    m_prefixes.push_back(Prefix{value, length, tlv});
+    return m_trie[node].prefix;
+}
+
+int PrefixSet::add(const std::string& cidr)
+{
+    auto slash = cidr.find('/');
+    if (slash == std::string::npos)
+        return add(IPAddress(cidr), 32);
+
+    return add(IPAddress(cidr.substr(0, slash)),
+               std::stoi(cidr.substr(slash + 1)));
+}
+
+int PrefixSet::lookup(uint32_t addr) const
+{
+    addr = ntohl(addr);
+
+    int ret = m_trie[0].prefix;
+    int32_t node = 0;
+    for (int i = 0; i < 32; ++i) {
+        node = m_trie[node].child[(addr >> (31 - i)) & 1];
+        if (node < 0)
+            break;
+        if (m_trie[node].prefix >= 0)
+            ret = m_trie[node].prefix;
+    }
+    return ret;
+}
+
+int PrefixSet::lookup(const of13::OXMTLV* value) const
+{
+    CHECK_EQ(value->field(), m_field);
+    IPAddress addr = (m_field == of13::OFPXMT_OFB_IPV4_SRC) ?
+            SMART_CAST<const of13::IPv4Src*>(value)->value() :
+            SMART_CAST<const of13::IPv4Dst*>(value)->value();
+    return lookup(addr.getIPv4());
+}
+
+bool PrefixSet::operator==(const PrefixSet& other) const
+{
+    if (this == &other)
+        return true;
+    if (m_field != other.m_field || m_prefixes.size() != other.m_prefixes.size())
+        return false;
+
+    for (size_t i = 0; i < m_prefixes.size(); ++i) {
+        if (m_prefixes[i].addr != other.m_prefixes[i].addr ||
+                m_prefixes[i].length != other.m_prefixes[i].length)
+            return false;
+    }
+    return true;
+}
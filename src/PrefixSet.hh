@@ -0,0 +1,75 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Common.hh"
+
+#include <memory>
+#include <vector>
+
+/**
+ * Set of IPv4 prefixes for the longest-prefix match on one field.
+ * Prefixes are stored in a binary trie, so lookup doesn't depend
+ * on the number of prefixes.
+ */
+class PrefixSet {
+public:
+    /// @param field OFPXMT_OFB_IPV4_SRC or OFPXMT_OFB_IPV4_DST
+    explicit PrefixSet(uint8_t field);
+    PrefixSet(const PrefixSet& other);
+    ~PrefixSet();
+
+    /**
+     * Adds prefix to the set. Host bits of the address are ignored.
+     * @return Index of the prefix (the existing one for duplicates).
+     */
+    int add(IPAddress addr, uint8_t length);
+    int add(const std::string& cidr);
+
+    uint8_t field() const { return m_field; }
+    size_t size() const { return m_prefixes.size(); }
+    uint8_t length(int i) const { return m_prefixes[i].length; }
+
+    /// Masked OXM value matching the i-th prefix
+    of13::OXMTLV* tlv(int i) const { return m_prefixes[i].tlv; }
+
+    /// @return Index of the longest matching prefix or -1
+    int lookup(uint32_t addr) const;
+    int lookup(const of13::OXMTLV* value) const;
+
+    bool operator==(const PrefixSet& other) const;
+
+private:
+    struct Prefix {
+        uint32_t addr; // host byte order
+        uint8_t length;
+        of13::OXMTLV* tlv;
+    };
+
+    struct TrieNode {
+        int32_t child[2];
+        int32_t prefix;
+    };
+
+    uint8_t m_field;
+    std::vector<Prefix> m_prefixes;
+    std::vector<TrieNode> m_trie;
+
+    PrefixSet& operator=(const PrefixSet&) = delete;
+};
+
+typedef std::shared_ptr<const PrefixSet> PrefixSetPtr;
@@ -16,7 +16,10 @@
 
 #include "STP.hh"
 
+#include <algorithm>
+
 #include "Topology.hh"
+#include "SwitchIndex.hh"
 
 REGISTER_APPLICATION(STP, {"switch-manager", "link-discovery", "topology", ""})
 
@@ -36,7 +39,7 @@ void SwitchSTP::resetBroadcast()
 void SwitchSTP::setSwitchPort(uint32_t port_no, uint64_t dpid)
 {
     ports.at(port_no)->to_switch = true;
-    ports.at(port_no)->nextSwitch = parent->switch_list[dpid];
+    ports.at(port_no)->nextSwitch = parent->findSwitch(dpid);
 }
 
 void STP::init(Loader* loader, const Config& config)
@@ -58,12 +61,8 @@ void STP::init(Loader* loader, const Config& config)
 STPPorts STP::getSTP(uint64_t dpid)
 {
     std::vector<uint32_t> ports;
-    if (switch_list.count(dpid) == 0) {
-        return ports;
-    }
-
-    SwitchSTP* sw = switch_list[dpid];    
-    if (!sw->computed) {
+    SwitchSTP* sw = findSwitch(dpid);
+    if (!sw || !sw->computed) {
         return ports;
     }
 
@@ -76,13 +75,11 @@ STPPorts STP::getSTP(uint64_t dpid)
 
 void STP::onLinkDiscovered(switch_and_port from, switch_and_port to)
 {
-    if (switch_list.count(from.dpid) == 0)
+    SwitchSTP* sw = findSwitch(from.dpid);
+    SwitchSTP* to_sw = findSwitch(to.dpid);
+    if (!sw || !to_sw)
         return;
 
-    if (switch_list.count(to.dpid) == 0)
-        return;
-
-    SwitchSTP* sw = switch_list[from.dpid];
     if (!sw->existsPort(from.port)) {
         Port* port = new Port(from.port);
         sw->ports[from.port] = port;
@@ -91,7 +88,7 @@ void STP::onLinkDiscovered(switch_and_port from, switch_and_port to)
         sw->unsetBroadcast(from.port);
     sw->setSwitchPort(from.port, to.dpid);
 
-    sw = switch_list[to.dpid];
+    sw = to_sw;
     if (!sw->existsPort(to.port)) {
         Port* port = new Port(to.port);
         sw->ports[to.port] = port;
@@ -101,30 +98,34 @@ void STP::onLinkDiscovered(switch_and_port from, switch_and_port to)
     sw->setSwitchPort(to.port, from.dpid);
 
     // recompute pathes for all switches
-    for (auto ss : switch_list) {
-        if (!ss.second->root)
-            ss.second->computed = false;
+    for (SwitchSTP* ss : switch_list) {
+        if (ss && !ss->root)
+            ss->computed = false;
     }
 }
 
 void STP::onLinkBroken(switch_and_port from, switch_and_port to)
 {
     // recompute pathes for all switches
-    for (auto ss : switch_list) {
-        if (!ss.second->root)
-            ss.second->computed = false;
+    for (SwitchSTP* ss : switch_list) {
+        if (ss && !ss->root)
+            ss->computed = false;
     }
 }
 
 void STP::onSwitchDiscovered(Switch* dp)
 {
+    bool first = std::none_of(switch_list.begin(), switch_list.end(),
+                              [](SwitchSTP* ss) { return ss != nullptr; });
     SwitchSTP* sw;
-    if (switch_list.empty())
+    if (first)
         sw = new SwitchSTP(dp, this, true, true);
     else
         sw = new SwitchSTP(dp, this);
 
-    switch_list[dp->id()] = sw;
+    if (dp->index() >= switch_list.size())
+        switch_list.resize(dp->index() + 1, nullptr);
+    switch_list[dp->index()] = sw;
 
     connect(dp, &Switch::portUp, this, &STP::onPortUp);
     connect(sw->timer, SIGNAL(timeout()), sw, SLOT(computeSTP()));
@@ -133,18 +134,18 @@ void STP::onSwitchDiscovered(Switch* dp)
 
 void STP::onSwitchDown(Switch* dp)
 {
-    if (switch_list.count(dp->id()) > 0) {
-        SwitchSTP* sw = switch_list[dp->id()];
+    SwitchSTP* sw = findSwitch(dp->id());
+    if (sw) {
         sw->timer->stop();
-        switch_list.erase(dp->id());
+        switch_list[dp->index()] = nullptr;
         delete sw;
     }
 }
 
 void STP::onPortUp(Switch *dp, of13::Port port)
 {
-    if (switch_list.count(dp->id()) > 0) {
-        SwitchSTP* sw = switch_list[dp->id()];
+    SwitchSTP* sw = findSwitch(dp->id());
+    if (sw) {
         if ( !sw->existsPort(port.port_no()) && port.port_no() < of13::OFPP_MAX ) {
             Port* p = new Port(port.port_no());
             sw->ports[port.port_no()] = p;
@@ -152,11 +153,17 @@ void STP::onPortUp(Switch *dp, of13::Port port)
     }
 }
 
+SwitchSTP* STP::findSwitch(uint64_t dpid)
+{
+    unsigned index = SwitchIndex::find(dpid);
+    return index < switch_list.size() ? switch_list[index] : nullptr;
+}
+
 SwitchSTP* STP::findRoot()
 {
-    for (auto it : switch_list) {
-        if (it.second->root)
-            return it.second;
+    for (SwitchSTP* sw : switch_list) {
+        if (sw && sw->root)
+            return sw;
     }
     return nullptr;
 }
@@ -164,17 +171,16 @@ SwitchSTP* STP::findRoot()
 void STP::computePathForSwitch(uint64_t dpid)
 {
     static std::mutex compute;
-    if (!switch_list[dpid]->computed) {
+    SwitchSTP* sw = findSwitch(dpid);
+    if (sw && !sw->computed) {
         SwitchSTP* root = findRoot();
         if (root == nullptr) {
             LOG(ERROR) << "Root switch not found!";
-            SwitchSTP* sw = switch_list[dpid];
             sw->root = true;
             sw->computed = true;
             return;
         }
 
-        SwitchSTP* sw = switch_list[dpid];
         std::vector<uint32_t> old_broadcast = getSTP(dpid);
 
         compute.lock();
@@ -187,18 +193,18 @@ void STP::computePathForSwitch(uint64_t dpid)
             if (sw->existsPort(broadcast_port))
                 sw->setBroadcast(broadcast_port);
 
-            sw->nextSwitchToRoot = switch_list[route[1].dpid];
+            sw->nextSwitchToRoot = findSwitch(route[1].dpid);
 
             // getting broadcast port on second switch
             data_link_route r_route = topo->computeRoute(route[1].dpid, dpid);
-            SwitchSTP* r_sw = switch_list[r_route[0].dpid];
+            SwitchSTP* r_sw = findSwitch(r_route[0].dpid);
             uint32_t r_broadcast_port = r_route[0].port;
-            if (r_sw->existsPort(r_broadcast_port))
+            if (r_sw && r_sw->existsPort(r_broadcast_port))
                 r_sw->setBroadcast(r_broadcast_port);
 
             for (auto port : sw->ports) {
                 if (port.second->to_switch) {
-                    if (port.second->nextSwitch->nextSwitchToRoot == sw) {
+                    if (port.second->nextSwitch && port.second->nextSwitch->nextSwitchToRoot == sw) {
                         sw->setBroadcast(port.second->port_no);
                     }
                 }
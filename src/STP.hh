@@ -89,9 +89,11 @@ protected slots:
     void onPortUp(Switch* dp, of13::Port port);
 
 private:
-    std::unordered_map<uint64_t, SwitchSTP*> switch_list;
+    // Indexed by Switch::index(), null for switches that are down
+    std::vector<SwitchSTP*> switch_list;
     class Topology* topo;
 
+    SwitchSTP* findSwitch(uint64_t dpid);
     SwitchSTP* findRoot();
     void computePathForSwitch(uint64_t dpid);
 
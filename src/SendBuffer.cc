@@ -0,0 +1,187 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SendBuffer.hh"
+
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <fluid/util/util.h>
+
+// Buffers kept by each thread and the capacity each may retain
+static const size_t poolSize = 8;
+static const size_t maxRetained = 1024 * 1024;
+
+static const size_t packetOutHeaderLength = 24;
+// Corked data is written when it grows over this size
+static const size_t corkThreshold = 64 * 1024;
+
+namespace {
+
+struct Pool {
+    std::vector<std::unique_ptr<std::vector<uint8_t>>> free;
+
+    std::vector<uint8_t>* acquire()
+    {
+        if (free.empty())
+            return new std::vector<uint8_t>();
+        std::vector<uint8_t>* ret = free.back().release();
+        free.pop_back();
+        return ret;
+    }
+
+    void release(std::vector<uint8_t>* buf)
+    {
+        if (free.size() >= poolSize || buf->capacity() > maxRetained) {
+            delete buf;
+            return;
+        }
+        buf->clear();
+        free.emplace_back(buf);
+    }
+};
+
+thread_local Pool pool;
+
+struct CorkState {
+    OFConnection* ofconn;
+    std::vector<uint8_t> data;
+};
+
+thread_local CorkState cork = { nullptr, {} };
+
+thread_local SendHook hook;
+
+void write(OFConnection* ofconn, const void* data, size_t len)
+{
+    if (hook)
+        hook(ofconn, data, len);
+    else
+        ofconn->send(const_cast<void*>(data), len);
+}
+
+}
+
+SendBuffer::SendBuffer()
+    : m_buf(pool.acquire())
+{ }
+
+SendBuffer::~SendBuffer()
+{
+    pool.release(m_buf);
+}
+
+uint8_t* SendBuffer::extend(size_t len)
+{
+    size_t offset = m_buf->size();
+    m_buf->resize(offset + len);
+    return m_buf->data() + offset;
+}
+
+void SendBuffer::append(const void* data, size_t len)
+{
+    if (len > 0)
+        memcpy(extend(len), data, len);
+}
+
+void SendBuffer::append(OFMsg& msg)
+{
+    uint8_t* buf = msg.pack();
+    append(buf, msg.length());
+    OFMsg::free_buffer(buf);
+}
+
+void SendBuffer::appendPacketOut(uint32_t xid, uint32_t buffer_id, uint32_t in_port,
+                                 ActionList& actions, const uint8_t* data, size_t data_len)
+{
+    uint16_t actions_len = actions.length();
+    uint16_t len = packetOutHeaderLength + actions_len + data_len;
+    uint8_t* p = extend(packetOutHeaderLength + actions_len);
+
+    uint16_t len_n = hton16(len);
+    uint32_t xid_n = hton32(xid);
+    uint32_t buffer_id_n = hton32(buffer_id);
+    uint32_t in_port_n = hton32(in_port);
+    uint16_t actions_len_n = hton16(actions_len);
+
+    p[0] = of13::OFP_VERSION;
+    p[1] = of13::OFPT_PACKET_OUT;
+    memcpy(p + 2, &len_n, 2);
+    memcpy(p + 4, &xid_n, 4);
+    memcpy(p + 8, &buffer_id_n, 4);
+    memcpy(p + 12, &in_port_n, 4);
+    memcpy(p + 16, &actions_len_n, 2);
+    memset(p + 18, 0, 6);
+    actions.pack(p + packetOutHeaderLength);
+
+    append(data, data_len);
+}
+
+void SendBuffer::send(OFConnection* ofconn)
+{
+    if (not m_buf->empty())
+        sendToSwitch(ofconn, m_buf->data(), m_buf->size());
+    m_buf->clear();
+}
+
+void sendToSwitch(OFConnection* ofconn, const void* data, size_t len)
+{
+    if (ofconn != cork.ofconn) {
+        write(ofconn, data, len);
+        return;
+    }
+
+    // Large batches don't need another copy
+    if (cork.data.empty() && len >= corkThreshold) {
+        write(ofconn, data, len);
+        return;
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    cork.data.insert(cork.data.end(), bytes, bytes + len);
+    if (cork.data.size() >= corkThreshold)
+        Cork::flush();
+}
+
+Cork::Cork(OFConnection* ofconn)
+    : m_owner(cork.ofconn != ofconn)
+{
+    if (m_owner) {
+        flush();
+        cork.ofconn = ofconn;
+    }
+}
+
+Cork::~Cork()
+{
+    if (m_owner) {
+        flush();
+        cork.ofconn = nullptr;
+    }
+}
+
+void Cork::flush()
+{
+    if (cork.ofconn && not cork.data.empty())
+        write(cork.ofconn, cork.data.data(), cork.data.size());
+    cork.data.clear();
+}
+
+void setSendHook(SendHook new_hook)
+{
+    hook = std::move(new_hook);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "Common.hh"
+
+#include <functional>
+#include <vector>
+
+/**
+ * Buffer OpenFlow messages are packed into before sending.
+ * Buffers are taken from a pool of the calling thread and keep their
+ * capacity, so in the steady state packing doesn't touch the heap.
+ * Messages built by the controller itself are packed in place;
+ * others go through OFMsg::pack().
+ */
+class SendBuffer {
+public:
+    SendBuffer();
+    ~SendBuffer();
+
+    /// Grows the buffer and returns pointer to the new bytes
+    uint8_t* extend(size_t len);
+    void append(const void* data, size_t len);
+    void append(OFMsg& msg);
+
+    /**
+     * Appends packet-out with the payload copied from the packet-in,
+     * without intermediate of13::PacketOut.
+     */
+    void appendPacketOut(uint32_t xid, uint32_t buffer_id, uint32_t in_port,
+                         ActionList& actions, const uint8_t* data, size_t data_len);
+
+    const uint8_t* data() const { return m_buf->data(); }
+    size_t size() const { return m_buf->size(); }
+    bool empty() const { return m_buf->empty(); }
+    void clear() { m_buf->clear(); }
+
+    /// Sends the contents as a single write and clears the buffer
+    void send(OFConnection* ofconn);
+
+private:
+    std::vector<uint8_t>* m_buf;
+
+    SendBuffer(const SendBuffer&) = delete;
+    SendBuffer& operator=(const SendBuffer&) = delete;
+};
+
+/**
+ * Sends data to the switch. Data for the connection corked by the
+ * calling thread is accumulated and written at once when the cork is
+ * removed or the accumulated size reaches the threshold.
+ */
+void sendToSwitch(OFConnection* ofconn, const void* data, size_t len);
+
+/**
+ * Replaces writes to switches made by the calling thread, e.g. to
+ * record the messages in checks. Empty hook restores the writes.
+ */
+typedef std::function<void(OFConnection* ofconn, const void* data, size_t len)> SendHook;
+void setSendHook(SendHook hook);
+
+/**
+ * Corks the connection for the calling thread during the object lifetime,
+ * e.g. while a message from the switch is handled. Nested corks of the
+ * same connection have no effect; corking another connection flushes
+ * and uncorks the previous one.
+ */
+class Cork {
+public:
+    explicit Cork(OFConnection* ofconn);
+    ~Cork();
+
+    /// Writes data accumulated by the calling thread
+    static void flush();
+
+private:
+    bool m_owner;
+
+    Cork(const Cork&) = delete;
+    Cork& operator=(const Cork&) = delete;
+};
@@ -16,12 +16,14 @@
 
 #include "SimpleLearningSwitch.hh"
 #include "Controller.hh"
+#include "Switch.hh"
 
-REGISTER_APPLICATION(SimpleLearningSwitch, {"controller", ""})
+REGISTER_APPLICATION(SimpleLearningSwitch, {"controller", "switch-manager", ""})
 
 void SimpleLearningSwitch::init(Loader *loader, const Config &config)
 {
     Controller* ctrl = Controller::get(loader);
+    switch_manager = SwitchManager::get(loader);
     ctrl->registerHandler(this);
 }
 
@@ -29,7 +31,7 @@ std::string SimpleLearningSwitch::orderingName() const
 { return "forwarding"; }
 
 std::unique_ptr<OFMessageHandler> SimpleLearningSwitch::makeOFMessageHandler()
-{ return std::unique_ptr<OFMessageHandler>(new Handler()); }
+{ return std::unique_ptr<OFMessageHandler>(new Handler(this)); }
 
 OFMessageHandler::Action SimpleLearningSwitch::Handler::processMiss(OFConnection* ofconn, Flow* flow)
 {
@@ -46,12 +48,21 @@ OFMessageHandler::Action SimpleLearningSwitch::Handler::processMiss(OFConnection
         return Stop;
     }
 
-    seen_port[eth_src] = in_port;
+    const Switch* sw = app->switch_manager->getSwitch(ofconn);
+    if (!sw) {
+        // Switch manager hasn't seen the switch up yet
+        flow->setFlags(Flow::Disposable);
+        flow->add_action(new of13::OutputAction(of13::OFPP_ALL, 128));
+        return Continue;
+    }
+
+    auto& switch_ports = seen_port[sw->id()];
+    switch_ports[eth_src] = in_port;
 
     // forward
-    auto it = seen_port.find(eth_dst);
+    auto it = switch_ports.find(eth_dst);
 
-    if (it != seen_port.end()) {
+    if (it != switch_ports.end()) {
         flow->idleTimeout(60);
         flow->timeToLive(5 * 60);
         flow->add_action(new of13::OutputAction(it->second, 0));
@@ -34,9 +34,13 @@ public:
 private:
     class Handler: public OFMessageHandler {
     public:
+        Handler(SimpleLearningSwitch* app_) : app(app_) { }
         Action processMiss(OFConnection* ofconn, Flow* flow) override;
     private:
-        // MAC -> port mapping for EVERY switch
-        std::unordered_map<EthAddress, uint32_t> seen_port;
+        SimpleLearningSwitch* app;
+        // dpid -> MAC -> port mapping of switches handled by the worker
+        std::unordered_map<uint64_t, std::unordered_map<EthAddress, uint32_t>> seen_port;
     };
+
+    class SwitchManager* switch_manager;
 };
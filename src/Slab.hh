@@ -0,0 +1,90 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Allocates objects of one type in large chunks. Owner destroys objects
+ * and may return their slots one by one for reuse, or release the whole
+ * slab at once. Chunks are never given back before that.
+ */
+template<class T, size_t ChunkSize = 256>
+class Slab {
+public:
+    Slab() : m_used(ChunkSize), m_free(nullptr), m_nfree(0) { }
+    ~Slab() { clear(); }
+
+    void* allocate()
+    {
+        if (m_free) {
+            FreeSlot* slot = m_free;
+            m_free = slot->next;
+            --m_nfree;
+            return slot;
+        }
+        if (m_used == ChunkSize) {
+            m_chunks.push_back(new Storage[ChunkSize]);
+            m_used = 0;
+        }
+        return &m_chunks.back()[m_used++];
+    }
+
+    /// Takes the slot of an already destroyed object
+    void free(void* p)
+    {
+        m_free = new (p) FreeSlot{ m_free };
+        ++m_nfree;
+    }
+
+    void clear()
+    {
+        for (Storage* chunk : m_chunks)
+            delete[] chunk;
+        m_chunks.clear();
+        m_used = ChunkSize;
+        m_free = nullptr;
+        m_nfree = 0;
+    }
+
+    /// Number of allocated objects
+    size_t size() const
+    {
+        size_t total = m_chunks.empty() ? 0 : (m_chunks.size() - 1) * ChunkSize + m_used;
+        return total - m_nfree;
+    }
+
+private:
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+    // Free slots are chained through their own storage
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+    static_assert(sizeof(T) >= sizeof(FreeSlot), "Slab objects can't hold a free slot");
+
+    std::vector<Storage*> m_chunks;
+    size_t m_used;
+    FreeSlot* m_free;
+    size_t m_nfree;
+
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+};
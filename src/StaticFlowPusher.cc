@@ -18,6 +18,7 @@
 
 #include "Controller.hh"
 #include "FlowManager.hh"
+#include "MessageTemplate.hh"
 #include "RestListener.hh"
 
 REGISTER_APPLICATION(StaticFlowPusher, {"controller", "switch-manager", "rest-listener", "flow-manager", ""})
@@ -119,7 +120,7 @@ ModifyList FlowDesc::modify()
 
 void StaticFlowPusher::init(Loader* loader, const Config& rootConfig)
 {
-    Controller* ctrl = Controller::get(loader);
+    ctrl = Controller::get(loader);
     new_flow = ctrl->registerStaticTransaction(this);
 
     start_prio = 1;
@@ -247,34 +248,43 @@ FlowDesc StaticFlowPusher::readFlowFromConfig(Config config)
     return fd;
 }
 
-void StaticFlowPusher::cleanFlowTable(OFConnection* ofconn)
+static of13::FlowMod cleanFlowTableMessage()
 {
     of13::FlowMod fm;
     fm.table_id(0);
     fm.command(of13::OFPFC_DELETE);
     fm.out_port(of13::OFPP_ANY);
     fm.out_group(of13::OFPG_ANY);
+    return fm;
+}
 
-    uint8_t* buf = fm.pack();
-    ofconn->send(buf, fm.length());
-    OFMsg::free_buffer(buf);
+void StaticFlowPusher::cleanFlowTable(OFConnection* ofconn)
+{
+    static const MessageTemplate clean(cleanFlowTableMessage());
+    clean.send(ofconn);
 }
 
 void StaticFlowPusher::sendDefault(Switch *sw)
 {
+    // Trace tree flips this rule between its tables on rebuild
     of13::FlowMod fm;
-    of13::GoToTable go_to_trace(1);
+    fm.priority(0);
+    TraceTree* trace_tree = ctrl->getTraceTree(sw->id());
+    of13::GoToTable go_to_trace(trace_tree ? trace_tree->table() : TraceTree::firstTable);
     fm.add_instruction(go_to_trace);
     sw->send(&fm);
 
     if (def_act == "to-controller") {
-        of13::FlowMod def;
-        def.table_id(1);
-        of13::ApplyActions act;
-        of13::OutputAction* out = new of13::OutputAction(of13::OFPP_CONTROLLER, 128);
-        act.add_action(out);
-        def.add_instruction(act);
-        sw->send(&def);
+        for (uint8_t table : {TraceTree::firstTable, TraceTree::secondTable}) {
+            of13::FlowMod def;
+            def.table_id(table);
+            def.priority(0);
+            of13::ApplyActions act;
+            of13::OutputAction* out = new of13::OutputAction(of13::OFPP_CONTROLLER, 128);
+            act.add_action(out);
+            def.add_instruction(act);
+            sw->send(&def);
+        }
     }
 }
 
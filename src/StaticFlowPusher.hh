@@ -75,6 +75,7 @@ public:
 
     json11::Json handlePOST(std::vector<std::string> params, std::string body) override;
 private:
+    class Controller* ctrl;
     SwitchManager* sw_m;
     class FlowManager* flow_m;
 
@@ -18,6 +18,7 @@
 
 #include "Controller.hh"
 #include "RestListener.hh"
+#include "SwitchIndex.hh"
 
 REGISTER_APPLICATION(SwitchStats, {"switch-manager", "controller", "rest-listener", ""})
 
@@ -112,8 +113,19 @@ void SwitchStats::startUp(Loader* provider)
 
 void SwitchStats::newSwitch(Switch *sw)
 {
-    SwitchPortStats newswitch(sw);
-    switch_stats.insert(std::pair<uint64_t, SwitchPortStats>(sw->id(), newswitch));
+    if (sw->index() >= switch_stats.size())
+        switch_stats.resize(sw->index() + 1);
+    // Stats are kept across reconnections
+    if (switch_stats[sw->index()].sw == nullptr)
+        switch_stats[sw->index()] = SwitchPortStats(sw);
+}
+
+SwitchPortStats* SwitchStats::findStats(uint64_t dpid)
+{
+    unsigned index = SwitchIndex::find(dpid);
+    if (index >= switch_stats.size() || switch_stats[index].sw == nullptr)
+        return nullptr;
+    return &switch_stats[index];
 }
 
 void SwitchStats::portStatsArrived(OFConnection* ofconn, std::shared_ptr<OFMsgUnion> reply)
@@ -127,12 +139,16 @@ void SwitchStats::portStatsArrived(OFConnection* ofconn, std::shared_ptr<OFMsgUn
 
     of13::MultipartReplyPortStats stats = reply->multipartReplyPortStats;
 
+    Switch* sw = m_switch_manager->getSwitch(ofconn);
+    SwitchPortStats* sps = sw ? findStats(sw->id()) : nullptr;
+    if (!sps)
+        return;
+
     std::vector<of13::PortStats> s = stats.port_stats();
     float tx_byte_speed = 0;
     float rx_byte_speed = 0;
     for (auto& i : s)
     {
-        uint64_t sw_id = m_switch_manager->getSwitch(ofconn)->id();
         uint32_t port_no = i.port_no();
         uint64_t tx_packets = i.tx_packets();
         uint64_t rx_packets = i.rx_packets();
@@ -141,11 +157,9 @@ void SwitchStats::portStatsArrived(OFConnection* ofconn, std::shared_ptr<OFMsgUn
         // check and count bytes per second
         port_packets_bytes newstat(port_no, tx_packets, rx_packets, tx_bytes, rx_bytes);
 
-        // find switch in old data
-        SwitchPortStats& sps = switch_stats.at(sw_id);
         try {
             // find port in old data
-            port_packets_bytes& ppb = sps.getElem(port_no);
+            port_packets_bytes& ppb = sps->getElem(port_no);
             tx_byte_speed = float((tx_bytes - ppb.tx_bytes)) / c_poll_interval;
             rx_byte_speed = float((rx_bytes - ppb.rx_bytes)) / c_poll_interval;
             ppb = newstat;
@@ -154,7 +168,7 @@ void SwitchStats::portStatsArrived(OFConnection* ofconn, std::shared_ptr<OFMsgUn
         }
         catch (const std::out_of_range&) {
             // no old data for this port, speed is not calculated
-            sps.insertElem(std::pair<uint32_t, port_packets_bytes>(port_no, newstat));
+            sps->insertElem(std::pair<uint32_t, port_packets_bytes>(port_no, newstat));
         }
     }
 }
@@ -167,7 +181,7 @@ void SwitchStats::pollTimeout()
         of13::MultipartRequestPortStats req;
         req.flags(0);
         req.port_no(of13::OFPP_ANY);
-        if (switch_stats.count(sw->id()))
+        if (findStats(sw->id()))
             pdescr->request(sw->ofconn(), &req);
     }
 }
@@ -175,12 +189,17 @@ void SwitchStats::pollTimeout()
 json11::Json SwitchStats::handleGET(std::vector<std::string> params, std::string body)
 {
     uint64_t id = std::stoull(params[1]);
+    SwitchPortStats* sps = findStats(id);
     if (params[2] == "all") {
-        return json11::Json(switch_stats[id].getPPB_vec());
+        if (!sps)
+            return json11::Json(std::vector<port_packets_bytes>());
+        return json11::Json(sps->getPPB_vec());
     }
     else {
         int port = atoi(params[2].c_str());
-        return json11::Json(switch_stats[id].port_stats[port]);
+        if (!sps)
+            return json11::Json(port_packets_bytes());
+        return json11::Json(sps->port_stats[port]);
     }
     return "{}";
 }
@@ -95,8 +95,10 @@ private:
     unsigned c_poll_interval;
     QTimer* m_timer;
     SwitchManager* m_switch_manager;
-    // port stats for each switch
-    std::unordered_map<uint64_t, SwitchPortStats> switch_stats;
+    // port stats for each switch, indexed by Switch::index()
+    std::vector<SwitchPortStats> switch_stats;
+
+    SwitchPortStats* findStats(uint64_t dpid);
     OFTransaction* pdescr;
 };
 
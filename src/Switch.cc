@@ -17,7 +17,10 @@
 #include "Switch.hh"
 
 #include <unordered_map>
+#include <memory>
 #include "RestListener.hh"
+#include "SendBuffer.hh"
+#include "SwitchIndex.hh"
 
 REGISTER_APPLICATION(SwitchManager, {"controller", "rest-listener", ""})
 
@@ -26,6 +29,7 @@ struct SwitchImpl {
     SwitchManager* mgr;
 
     uint64_t         id;
+    unsigned         index;
     uint32_t         nbuffers;
     uint8_t          ntables;
     uint32_t         capabilities;
@@ -43,7 +47,8 @@ struct SwitchManagerImpl {
 
     QReadWriteLock switch_lock;
     std::unordered_map<int, Switch*> switch_by_conn;
-    std::unordered_map<uint64_t, Switch> switches;
+    // Indexed by SwitchIndex, switches are kept after disconnection
+    std::vector<std::unique_ptr<Switch>> switches;
 };
 
 SwitchManager::SwitchManager()
@@ -68,11 +73,11 @@ Switch* SwitchManager::getSwitch(OFConnection* ofconn) const
 
 Switch* SwitchManager::getSwitch(uint64_t dpid)
 {
-    try {
-        return &m->switches.at(dpid);
-    } catch (const std::out_of_range& e) {
+    unsigned index = SwitchIndex::find(dpid);
+    QReadLocker locker(&m->switch_lock);
+    if (index >= m->switches.size())
         return nullptr;
-    }
+    return m->switches[index].get();
 }
 
 void SwitchManager::init(Loader* loader, const Config& config)
@@ -122,29 +127,27 @@ void SwitchManager::onSwitchUp(OFConnection* ofconn, of13::FeaturesReply fr)
         return;
     }
 
-    auto it = m->switches.find(fr.datapath_id());
+    unsigned index = SwitchIndex::intern(fr.datapath_id());
+    if (index >= m->switches.size())
+        m->switches.resize(index + 1);
+    Switch* dp = m->switches[index].get();
 
-    if (it == m->switches.end()) {
-        it = m->switches.emplace(
-                std::piecewise_construct,
-                std::forward_as_tuple(fr.datapath_id()),
-                std::forward_as_tuple(this, ofconn, fr)
-        ).first;
+    if (dp == nullptr) {
+        m->switches[index].reset(dp = new Switch(this, ofconn, fr));
+        m->switch_by_conn[conn_id] = dp;
         locker.unlock();
-
-        emit switchDiscovered(m->switch_by_conn[conn_id] = &it->second);
     } else {
-        m->switch_by_conn[conn_id] = &it->second;
+        m->switch_by_conn[conn_id] = dp;
         locker.unlock();
 
-        it->second.setUp(ofconn, fr);
-        emit switchDiscovered(m->switch_by_conn[conn_id]);
+        dp->setUp(ofconn, fr);
     }
+    emit switchDiscovered(dp);
 
-    it->second.requestPortDescriptions();
-    it->second.requestSwitchDescriptions();
+    dp->requestPortDescriptions();
+    dp->requestSwitchDescriptions();
 
-    addEvent(Event::Add, &it->second);
+    addEvent(Event::Add, dp);
 }
 
 void SwitchManager::onSwitchDown(OFConnection* ofconn)
@@ -201,11 +204,13 @@ std::vector<Switch*> SwitchManager::switches()
     std::vector<Switch*> ret;
     ret.reserve(m->switches.size());
 
-    for (auto& pair : m->switches) {
-        OFConnection* conn = pair.second.m->conn;
+    for (auto& dp : m->switches) {
+        if (not dp)
+            continue;
+        OFConnection* conn = dp->m->conn;
 
         if (conn->get_state() == OFConnection::STATE_RUNNING)
-            ret.push_back(&pair.second);
+            ret.push_back(dp.get());
     }
     return ret;
 }
@@ -220,6 +225,7 @@ Switch::Switch(SwitchManager* mgr,
     m->mgr = mgr;
     m->conn = conn;
     m->id = fr.datapath_id();
+    m->index = SwitchIndex::intern(m->id);
     m->nbuffers = fr.n_buffers();
     m->ntables = fr.n_tables();
     m->capabilities = fr.capabilities();
@@ -410,7 +416,7 @@ void Switch::portDescArrived(of13::MultipartReplyPortDescription &desc)
 void Switch::send(OFMsg *msg)
 {
     uint8_t* data = msg->pack();
-    m->conn->send(data, msg->length());
+    sendToSwitch(m->conn, data, msg->length());
     OFMsg::free_buffer(data);
 }
 
@@ -419,6 +425,11 @@ uint64_t Switch::id() const
     return m->id;
 }
 
+unsigned Switch::index() const
+{
+    return m->index;
+}
+
 uint32_t Switch::nbuffers() const
 {
     return m->nbuffers;
@@ -34,6 +34,8 @@ public:
 
     std::string idstr() const;
     uint64_t id() const override;
+    /// Dense SwitchIndex of the datapath id
+    unsigned index() const;
     uint32_t nbuffers() const;
     uint8_t  ntables() const;
     uint32_t capabilites() const;
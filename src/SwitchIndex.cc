@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SwitchIndex.hh"
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Interner {
+    std::mutex mutex;
+    std::unordered_map<uint64_t, unsigned> index;
+    std::vector<uint64_t> dpids;
+};
+
+Interner& interner()
+{
+    static Interner ret;
+    return ret;
+}
+
+}
+
+unsigned SwitchIndex::intern(uint64_t dpid)
+{
+    Interner& in = interner();
+    std::lock_guard<std::mutex> lock(in.mutex);
+
+    auto it = in.index.emplace(dpid, in.dpids.size()).first;
+    if (it->second == in.dpids.size())
+        in.dpids.push_back(dpid);
+    return it->second;
+}
+
+unsigned SwitchIndex::find(uint64_t dpid)
+{
+    Interner& in = interner();
+    std::lock_guard<std::mutex> lock(in.mutex);
+
+    auto it = in.index.find(dpid);
+    return it != in.index.end() ? it->second : none;
+}
+
+uint64_t SwitchIndex::dpid(unsigned index)
+{
+    Interner& in = interner();
+    std::lock_guard<std::mutex> lock(in.mutex);
+    return in.dpids.at(index);
+}
+
+unsigned SwitchIndex::size()
+{
+    Interner& in = interner();
+    std::lock_guard<std::mutex> lock(in.mutex);
+    return in.dpids.size();
+}
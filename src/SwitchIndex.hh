@@ -0,0 +1,37 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Interns datapath ids. Every switch gets a small index when it comes up
+ * for the first time and keeps it across reconnections. Indexes are
+ * dense, so subsystems keep per-switch data in vectors indexed by them.
+ */
+class SwitchIndex {
+public:
+    static const unsigned none = ~0u;
+
+    /// Index of the switch, assigned on the first call
+    static unsigned intern(uint64_t dpid);
+    /// Index of the known switch or `none`
+    static unsigned find(uint64_t dpid);
+    static uint64_t dpid(unsigned index);
+    /// Number of interned switches, all indexes are below it
+    static unsigned size();
+};
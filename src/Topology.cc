@@ -16,12 +16,11 @@
 
 #include "Topology.hh"
 
-#include <unordered_map>
-
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/dijkstra_shortest_paths_no_color_map.hpp>
 
 #include "Common.hh"
+#include "SwitchIndex.hh"
 
 REGISTER_APPLICATION(Topology, {"link-discovery", "rest-listener", ""})
 
@@ -98,17 +97,22 @@ typedef TopologyGraph::vertex_descriptor
 struct TopologyImpl {
     QReadWriteLock graph_mutex;
 
+    // Vertices are never removed, so vertex of the switch is its index
     TopologyGraph graph;
-    std::unordered_map<uint64_t, vertex_descriptor>
-        vertex_map;
 
     vertex_descriptor vertex(uint64_t dpid) {
-        auto it = vertex_map.find(dpid);
-        if (it != vertex_map.end()) {
-            return it->second;
-        } else {
-            return vertex_map[dpid] = add_vertex(graph);
-        }
+        vertex_descriptor v = SwitchIndex::intern(dpid);
+        while (num_vertices(graph) <= v)
+            add_vertex(graph);
+        return v;
+    }
+
+    // Doesn't modify the graph, null_vertex() for unknown switches
+    vertex_descriptor find(uint64_t dpid) {
+        unsigned index = SwitchIndex::find(dpid);
+        if (index == SwitchIndex::none || index >= num_vertices(graph))
+            return TopologyGraph::null_vertex();
+        return index;
     }
 };
 
@@ -173,21 +177,20 @@ data_link_route Topology::computeRoute(uint64_t from_dpid, uint64_t to_dpid)
     auto& graph = m->graph;
 
     data_link_route ret;
-    if (num_vertices(graph) == 0)
+    vertex_descriptor to = m->find(to_dpid);
+    vertex_descriptor v = m->find(from_dpid);
+    if (to == TopologyGraph::null_vertex() || v == TopologyGraph::null_vertex())
         return ret;
 
     std::vector<vertex_descriptor> p(num_vertices(graph), TopologyGraph::null_vertex());
 
-    dijkstra_shortest_paths_no_color_map(graph, m->vertex(to_dpid),
+    dijkstra_shortest_paths_no_color_map(graph, to,
          weight_map( boost::get(&link_property::weight, graph) )
         .predecessor_map( make_iterator_property_map(p.begin(), boost::get(vertex_index, graph)) )
     );
 
     // TODO: compute complete route
 
-    vertex_descriptor v = m->vertex(from_dpid);
-    if (p.size() <= v)
-        return ret;
     vertex_descriptor u = p.at(v);
 
     if (u != TopologyGraph::null_vertex()) {
@@ -17,13 +17,24 @@
 #include "TraceTree.hh"
 
 #include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <unordered_set>
+#include <fluid/util/util.h>
 
 #include "Flow.hh"
 #include "Match.hh"
 #include "FluidDump.hh"
+#include "MessageTemplate.hh"
+#include "CompiledTraceTree.hh"
+#include "PacketInView.hh"
+#include "PortRange.hh"
+#include "SendBuffer.hh"
 
-static const uint64_t flowCookieBase = 0x100000000UL;
-static const uint64_t flowCookieMask = 0xffffffff00000000UL;
+static const uint64_t flowCookieBase = TraceTree::cookieBase;
+static const uint64_t flowCookieMask = TraceTree::cookieMask;
 of13::InstructionSet toController;
 
 static struct InitToController {
@@ -35,10 +46,116 @@ static struct InitToController {
     }
 } initToController;
 
+const uint8_t TraceTree::firstTable;
+const uint8_t TraceTree::secondTable;
+const uint64_t TraceTree::cookieBase;
+const uint64_t TraceTree::cookieMask;
+
+static const uint16_t minPriority = 1;
+static const uint16_t maxPriority = 0xffff;
+static const size_t flushThreshold = 64 * 1024;
+static const unsigned loadIndexThreshold = 8;
+static const uint64_t groupMask = 0xffffffffffffffffUL;
+// Eviction frees a tenth of the capacity at once
+static const unsigned evictionSlack = 10;
+static const std::chrono::seconds statsInterval(1);
+
+static std::string dumpValue(const CompactTLV& value)
+{
+    std::unique_ptr<of13::OXMTLV> tlv(value.makeTLV());
+    return ::dump(tlv.get());
+}
+
+static of13::FlowMod cleanTableMessage()
+{
+    of13::FlowMod fm;
+    fm.cookie(flowCookieBase);
+    fm.cookie_mask(flowCookieMask);
+    fm.command(of13::OFPFC_DELETE);
+    fm.out_port(of13::OFPP_ANY);
+    fm.out_group(of13::OFPG_ANY);
+    return fm;
+}
+
+static void sendCleanTable(OFConnection* ofconn, FlowModPacer& pacer, uint8_t table)
+{
+    static const MessageTemplate clean(cleanTableMessage());
+
+    SendBuffer buf;
+    uint8_t* msg = clean.copyTo(buf);
+    MessageTemplate::set8(msg, MessageTemplate::flowModTableId, table);
+    pacer.send(ofconn, buf.data(), buf.size(), 1);
+}
+
 TraceTree::TraceTree()
-{  }
+    : m_batch(0), m_compiled(nullptr), m_table(firstTable),
+      m_pending_rules(0), m_rebalance(false), m_compress(false), m_rebuild(false),
+      m_stages(1), m_groups(0), m_capacity(0), m_occupancy(0)
+{
+    root.setPriorities(minPriority, maxPriority);
+}
+
+TraceTree::~TraceTree()
+{
+    // Leaves refer to the index destroyed before the root
+    clear();
+    delete m_compiled;
+}
+
+void TraceTree::setCompiled(bool enable)
+{
+    QWriteLocker lock(&m_lock);
+    if (enable && not m_compiled) {
+        m_compiled = new CompiledTraceTree();
+    } else if (not enable) {
+        delete m_compiled;
+        m_compiled = nullptr;
+    }
+}
+
+void TraceTree::setCompression(bool enable)
+{
+    QWriteLocker lock(&m_lock);
+    m_compress = enable;
+}
+
+void TraceTree::setPipeline(unsigned stages)
+{
+    QWriteLocker lock(&m_lock);
+    m_stages = std::max(stages, 1u);
+}
+
+void TraceTree::setCapacity(unsigned rules)
+{
+    QWriteLocker lock(&m_lock);
+    m_capacity = rules;
+}
+
+unsigned TraceTree::capacity() const
+{
+    QReadLocker lock(&m_lock);
+    return m_capacity;
+}
 
-bool TraceTree::isTableMiss(of13::PacketIn& pi)
+unsigned TraceTree::occupancy() const
+{
+    QReadLocker lock(&m_lock);
+    return m_occupancy;
+}
+
+void TraceTree::setOccupancy(unsigned rules)
+{
+    QWriteLocker lock(&m_lock);
+    m_occupancy = rules;
+}
+
+bool TraceTree::usesTable(uint8_t table) const
+{
+    QReadLocker lock(&m_lock);
+    return table >= firstTable && table < firstTable + 2 * m_stages;
+}
+
+bool TraceTree::isTableMiss(const PacketInView& pi)
 {
     if (pi.reason() == of13::OFPR_NO_MATCH)
         return true;
@@ -47,35 +164,78 @@ bool TraceTree::isTableMiss(of13::PacketIn& pi)
     return false;
 }
 
+uint8_t TraceTree::table() const
+{
+    QReadLocker lock(&m_lock);
+    return m_table;
+}
+
 void TraceTree::cleanFlowTable(OFConnection* ofconn)
 {
-    of13::FlowMod fm;
-    fm.table_id(1);
-    fm.cookie(flowCookieBase);
-    fm.cookie_mask(flowCookieMask);
-    fm.command(of13::OFPFC_DELETE);
-    fm.out_port(of13::OFPP_ANY);
-    fm.out_group(of13::OFPG_ANY);
+    QWriteLocker lock(&m_lock);
+    // Rules may be left in both tables
+    sendCleanTable(ofconn, m_pacer, of13::OFPTT_ALL);
+}
 
-    uint8_t* buf = fm.pack();
-    ofconn->send(buf, fm.length());
-    OFMsg::free_buffer(buf);
+void TraceTree::cleanTables(OFConnection* ofconn, uint8_t table)
+{
+    for (unsigned stage = 0; stage < m_stages; ++stage)
+        sendCleanTable(ofconn, m_pacer, table + 2 * stage);
 }
 
 struct BuildFTContext {
-    uint64_t cookie;
     OFConnection *ofconn;
-    std::vector<of13::OXMTLV*> match;
-    uint16_t priority;
-    TraceTree* tree;
+    FlowModPacer* pacer;
+    std::vector<uint8_t>& out;
+    std::vector<CompactTLV> match;
+    // Values covering ranges on the path; rules are emitted for
+    // every combination of them
+    std::vector<const std::vector<CompactTLV>*> ranges;
+    uint8_t table;
+    // Last table the pipeline may use
+    uint8_t lastTable;
+    unsigned rules;
+
+    struct Summary {
+        // Every packet reaching the subtree hits a permanent rule
+        bool covered;
+        // Leaf whose rule may stand for the whole subtree
+        TraceTreeNode* merged;
+    };
+    // Filled by analyze() when compression is enabled
+    std::unordered_map<TraceTreeNode*, Summary> summary;
+    unsigned merged;
+    unsigned omitted;
 
-    std::vector<of13::OXMTLV*> match_combine()
+    // Equal subtrees have equal shapes, filled by shapeOf()
+    std::unordered_map<TraceTreeNode*, unsigned> shape;
+    std::unordered_map<std::string, unsigned> shapes;
+    // Estimated number of rules of each shape
+    std::vector<unsigned> shapeRules;
+
+    struct Group {
+        uint32_t id;
+        TraceTreeNode* first;
+    };
+    // Groups installed by this build keyed by table and shape
+    std::unordered_map<uint64_t, Group> groups;
+    uint32_t lastGroup;
+    // Rules already passed to the pacer
+    unsigned flushed;
+
+    BuildFTContext(OFConnection* ofconn_, FlowModPacer* pacer_,
+                   std::vector<uint8_t>& out_, uint8_t table_)
+        : ofconn(ofconn_), pacer(pacer_), out(out_), table(table_), lastTable(table_),
+          rules(0), merged(0), omitted(0), lastGroup(0), flushed(0)
+    { }
+
+    std::vector<CompactTLV> match_combine()
     {
         auto match_ = match;
         auto field_less =
-                [](of13::OXMTLV* a, of13::OXMTLV* b) { return a->field() < b->field(); };
+                [](const CompactTLV& a, const CompactTLV& b) { return a.field < b.field; };
         auto field_equal =
-                [](of13::OXMTLV* a, of13::OXMTLV* b) { return a->field() == b->field(); };
+                [](const CompactTLV& a, const CompactTLV& b) { return a.field == b.field; };
 
         std::sort(match_.begin(), match_.end(), field_less);
         auto last = std::unique(match_.begin(), match_.end(), field_equal);
@@ -84,81 +244,706 @@ struct BuildFTContext {
         return match_;
     }
 
-    uint64_t emitRule(Flow* flow, of13::FlowMod* fm);
-    uint64_t emitBarrier();
+    template<class F>
+    void forEachRangeValue(F f, size_t depth = 0)
+    {
+        if (depth == ranges.size()) {
+            f();
+            return;
+        }
+        for (const CompactTLV& value : *ranges[depth]) {
+            match.push_back(value);
+            forEachRangeValue(f, depth + 1);
+            match.pop_back();
+        }
+    }
+
+    of13::Match makeMatch()
+    {
+        of13::Match m;
+        for (const CompactTLV& tlv : match_combine())
+            m.add_oxm_field(tlv.makeTLV());
+        return m;
+    }
+
+    Summary lookup(TraceTreeNode* t) const
+    {
+        auto it = summary.find(t);
+        return it != summary.end() ? it->second : Summary{false, nullptr};
+    }
+
+    void append(OFMsg* msg);
+    void flush();
+    void emitRule(TraceTreeNode* t, uint16_t priority);
+    void emitMerged(TraceTreeNode* t, TraceTreeNode* leaf);
+    void emitBarrier(uint16_t priority);
+    void emitGoTo(uint16_t priority, uint32_t group);
+    bool omitBarrier(TraceTreeNode* child);
+    Summary analyze(TraceTreeNode* t);
+    unsigned shapeOf(TraceTreeNode* t);
+    bool factor(TraceTreeNode* t);
+    void enterGroup(uint32_t group);
+    void buildGroup(TraceTreeNode* child, const CompactTLV& value);
     void buildFlowTableStep(TraceTreeNode* t);
 };
 
+static bool isPermanent(TraceTreeNode::LeafData* leaf)
+{
+    return leaf->fm->idle_timeout() == 0 && leaf->fm->hard_timeout() == 0;
+}
+
+static bool isPermanent(TraceTreeNode* t)
+{
+    return isPermanent(t->leaf);
+}
+
+// Everything of the leaf rule except match, priority and cookie
+static std::string ruleKey(TraceTreeNode* t)
+{
+    of13::FlowMod* fm = t->leaf->fm;
+    uint16_t head[3] = { fm->idle_timeout(), fm->hard_timeout(), fm->flags() };
+    std::string ret(reinterpret_cast<const char*>(head), sizeof(head));
+
+    of13::InstructionSet instructions = fm->instructions();
+    std::string body(instructions.length(), '\0');
+    instructions.pack(reinterpret_cast<uint8_t*>(&body[0]));
+    return ret + body;
+}
+
+static bool sameRule(TraceTreeNode* a, TraceTreeNode* b)
+{
+    return ruleKey(a) == ruleKey(b);
+}
+
+// Makes the leaf reinstall the rule of another one. Same rule under
+// another cookie would replace the installed one, so the rule keeps
+// the cookie of the leaf that emitted it.
+static void copyRule(TraceTreeNode* from, TraceTreeNode* to)
+{
+    of13::FlowMod* fm = from->leaf->fm;
+    to->leaf->owner = from->leaf->owner ? from->leaf->owner : fm->cookie();
+    to->leaf->index->unlink(to->leaf);
+    to->leaf->fm->table_id(fm->table_id());
+    to->leaf->fm->priority(fm->priority());
+    to->leaf->fm->match(fm->match());
+    to->leaf->fm->buffer_id(OFP_NO_BUFFER);
+
+    delete to->leaf->packed;
+    to->leaf->packed = nullptr;
+    delete to->leaf->matches;
+    to->leaf->matches = from->leaf->matches ?
+            new std::vector<of13::Match>(*from->leaf->matches) : nullptr;
+}
+
+// Walks two subtrees of the same shape in parallel
+static void copyRules(TraceTreeNode* from, TraceTreeNode* to)
+{
+    // Leaves might expire since the shapes were computed
+    if (from->m_type != to->m_type)
+        return;
+
+    switch (from->m_type) {
+    case TraceTreeNode::Leaf:
+        copyRule(from, to);
+        break;
+    case TraceTreeNode::Test:
+        copyRules(from->test.negativeChild, to->test.negativeChild);
+        copyRules(from->test.positiveChild, to->test.positiveChild);
+        break;
+    case TraceTreeNode::Range:
+        copyRules(from->range.negativeChild, to->range.negativeChild);
+        copyRules(from->range.positiveChild, to->range.positiveChild);
+        break;
+    case TraceTreeNode::Prefix:
+        for (size_t i = 0; i <= from->prefix.set->size(); ++i)
+            copyRules(from->prefix.children[i], to->prefix.children[i]);
+        break;
+    case TraceTreeNode::Load:
+        for (TraceTreeNode::LoadData *a = &from->load, *b = &to->load;
+             a && b; a = a->next, b = b->next)
+            copyRules(a->child, b->child);
+        break;
+    case TraceTreeNode::Empty:
+        break;
+    }
+}
+
+template<class F>
+static void forEachLeaf(TraceTreeNode* t, F f)
+{
+    switch (t->type()) {
+    case TraceTreeNode::Leaf:
+        f(t);
+        break;
+    case TraceTreeNode::Test:
+        forEachLeaf(t->test.negativeChild, f);
+        forEachLeaf(t->test.positiveChild, f);
+        break;
+    case TraceTreeNode::Range:
+        forEachLeaf(t->range.negativeChild, f);
+        forEachLeaf(t->range.positiveChild, f);
+        break;
+    case TraceTreeNode::Prefix:
+        for (size_t i = 0; i <= t->prefix.set->size(); ++i)
+            forEachLeaf(t->prefix.children[i], f);
+        break;
+    case TraceTreeNode::Load:
+        for (TraceTreeNode::LoadData* l = &t->load; l; l = l->next)
+            forEachLeaf(l->child, f);
+        break;
+    case TraceTreeNode::Empty:
+        break;
+    }
+}
+
 unsigned TraceTree::buildFlowTable(OFConnection* ofconn)
 {
-    BuildFTContext ctx;
-    ctx.ofconn = ofconn;
-    ctx.priority = 1;
-    ctx.cookie = flowCookieBase;
-    ctx.tree = this;
+    QWriteLocker lock(&m_lock);
+    return buildFlowTable(ofconn, m_table);
+}
+
+unsigned TraceTree::buildFlowTable(OFConnection* ofconn, uint8_t table)
+{
+    // Full rebuild includes everything accumulated by augment()
+    m_pending.clear();
+    m_pending_rules = 0;
+    m_rebuild = false;
+    ++m_batch;
 
+    std::vector<uint8_t> out;
+    BuildFTContext ctx(ofconn, &m_pacer, out, table);
+    ctx.lastTable = table + 2 * (m_stages - 1);
+
+    if (m_compress)
+        ctx.analyze(&root);
+    if (m_stages > 1) {
+        ctx.shapeOf(&root);
+        // Packets falling through rules of a group go to the controller
+        for (unsigned stage = 1; stage < m_stages; ++stage) {
+            ctx.table = table + 2 * stage;
+            ctx.emitBarrier(0);
+        }
+        ctx.table = table;
+    }
     ctx.buildFlowTableStep(&root);
+    ctx.flush();
     DCHECK_EQ(ctx.match.size(), 0u);
+    m_groups = ctx.lastGroup;
+    m_occupancy = ctx.rules;
+
+    if (m_compress) {
+        DVLOG(5) << "Compression merged " << ctx.merged << " leaves and omitted "
+                 << ctx.omitted << " barriers";
+    }
+    if (m_stages > 1) {
+        DVLOG(5) << "Pipeline uses " << ctx.groups.size() << " groups for "
+                 << ctx.shapes.size() << " distinct subtrees";
+    }
 
-    return (unsigned) (ctx.cookie - flowCookieBase);
+    return ctx.rules;
 }
 
-uint64_t BuildFTContext::emitRule(Flow* flow, of13::FlowMod* fm)
+unsigned TraceTree::updateFlowTable(OFConnection* ofconn)
 {
-    fm->table_id(1);
-    fm->cookie(++cookie);
-    fm->priority(priority);
+    QWriteLocker lock(&m_lock);
+    if (m_rebalance || m_rebuild) {
+        if (m_rebalance)
+            rebalance();
+        return rebuild(ofconn);
+    }
+
+    unsigned rules = m_pending_rules;
+    ++m_batch;
+    makeRoom(ofconn, rules);
+    if (not m_pending.empty())
+        m_pacer.send(ofconn, m_pending.data(), m_pending.size(), rules);
+    m_occupancy += rules;
+
+    m_pending.clear();
+    m_pending_rules = 0;
+    return rules;
+}
 
-    of13::Match m;
-    for (of13::OXMTLV* tlv : match_combine())
-        m.add_oxm_field(tlv->clone());
-    fm->match(m);
+void TraceTree::invalidateFlowTable()
+{
+    QWriteLocker lock(&m_lock);
+    m_rebuild = true;
+}
 
-    uint8_t* buf = fm->pack();
-    ofconn->send(buf, fm->length());
+bool TraceTree::needsUpdate() const
+{
+    QReadLocker lock(&m_lock);
+    return m_rebalance || m_rebuild || m_pending_rules > 0;
+}
+
+unsigned TraceTree::rebuild(OFConnection* ofconn)
+{
+    uint8_t standby = (m_table == firstTable) ? secondTable : firstTable;
+    DVLOG(5) << "Rebuilding flow table " << (int) standby
+             << " on conn = " << ofconn->get_id();
+
+    // Switch doesn't reorder messages across barriers, so there is
+    // no need to wait for replies: table 0 is redirected only after
+    // the standby table is completely installed.
+    // Standby table gets no barriers of the pruned subtrees
+    size_t nodes = m_storage.nodes.size();
+    root.prune(m_storage, m_compiled);
+    if (m_storage.nodes.size() != nodes)
+        DVLOG(5) << "Pruned " << nodes - m_storage.nodes.size() << " nodes";
+
+    cleanTables(ofconn, standby);
+    m_pacer.barrier(ofconn);
+    unsigned rules = buildFlowTable(ofconn, standby);
+    m_pacer.barrier(ofconn);
+
+    of13::FlowMod fm;
+    fm.table_id(0);
+    fm.priority(0);
+    fm.command(of13::OFPFC_ADD);
+    fm.buffer_id(OFP_NO_BUFFER);
+    of13::GoToTable go_to_trace(standby);
+    fm.add_instruction(go_to_trace);
+
+    uint8_t* buf = fm.pack();
+    m_pacer.send(ofconn, buf, fm.length(), 1);
     OFMsg::free_buffer(buf);
 
-    return cookie;
+    m_pacer.barrier(ofconn);
+    cleanTables(ofconn, m_table);
+
+    m_table = standby;
+    makeRoom(ofconn, 0);
+    return rules;
 }
 
-uint64_t BuildFTContext::emitBarrier()
+void TraceTree::makeRoom(OFConnection* ofconn, unsigned rules)
+{
+    if (m_capacity == 0 || m_occupancy + rules <= m_capacity)
+        return;
+
+    unsigned target = m_capacity - m_capacity / evictionSlack;
+    unsigned need = m_occupancy + rules - std::min(target, m_occupancy + rules);
+
+    // Leaves are taken from the least recently hit one. Those that
+    // can't be evicted leave the list until they're touched again.
+    std::vector<uint8_t> out;
+    unsigned freed = 0, evicted = 0;
+    for (TraceTreeNode::LeafData* l = m_leaves.oldest; l && freed < need; ) {
+        TraceTreeNode::LeafData* next = l->newer;
+        m_leaves.unlink(l);
+        // Compression relies on permanent rules being installed,
+        // and shared rules are evicted through their owners
+        if (l->flow->state() != Flow::Live || l->owner ||
+                (m_compress && isPermanent(l))) {
+            l = next;
+            continue;
+        }
+
+        of13::FlowMod fm;
+        fm.table_id(of13::OFPTT_ALL);
+        fm.cookie(l->fm->cookie());
+        fm.cookie_mask(0xffffffffffffffffUL);
+        fm.command(of13::OFPFC_DELETE);
+        fm.out_port(of13::OFPP_ANY);
+        fm.out_group(of13::OFPG_ANY);
+
+        uint8_t* buf = fm.pack();
+        out.insert(out.end(), buf, buf + fm.length());
+        OFMsg::free_buffer(buf);
+
+        l->flow->setShadow();
+        freed += 1 + (l->matches ? l->matches->size() : 0);
+        ++evicted;
+        l = next;
+    }
+
+    if (not out.empty()) {
+        m_pacer.send(ofconn, out.data(), out.size(), evicted);
+        // New rules shouldn't overtake the deletions
+        m_pacer.barrier(ofconn);
+    }
+    m_occupancy -= std::min(freed, m_occupancy);
+
+    DVLOG(5) << "Evicted " << evicted << " leaves, " << freed << " rules";
+    if (freed < need) {
+        LOG(WARNING) << "Not enough rules to evict, flow table of conn = "
+                     << ofconn->get_id() << " may overflow";
+    }
+}
+
+void TraceTree::tableFull()
+{
+    QWriteLocker lock(&m_lock);
+    // Refused rule was counted in the occupancy when it was sent
+    if (m_occupancy > 0)
+        --m_occupancy;
+    unsigned rules = std::max(m_occupancy, 1u);
+    if (m_capacity == 0 || rules < m_capacity) {
+        LOG(WARNING) << "Flow table is full, limiting trace tree to " << rules << " rules";
+        m_capacity = rules;
+    }
+}
+
+void TraceTree::removed(uint64_t cookie)
+{
+    QWriteLocker lock(&m_lock);
+    if (m_leaves.cookies.count(cookie) && m_occupancy > 0)
+        --m_occupancy;
+}
+
+void TraceTree::hit(uint64_t cookie, uint64_t packets)
+{
+    QWriteLocker lock(&m_lock);
+    TraceTreeNode::LeafData* l = findLeaf(cookie);
+    if (l && l->packets != packets) {
+        l->packets = packets;
+        m_leaves.touch(l);
+    }
+}
+
+bool TraceTree::needsStats()
+{
+    QWriteLocker lock(&m_lock);
+    // Recency is needed only when eviction is close
+    if (m_capacity == 0 || m_occupancy * 5 < m_capacity * 4)
+        return false;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - m_stats_requested < statsInterval)
+        return false;
+    m_stats_requested = now;
+    return true;
+}
+
+bool TraceTree::pending(TraceTreeNode::LeafData* leaf) const
+{
+    QReadLocker lock(&m_lock);
+    return leaf->batch == m_batch;
+}
+
+void TraceTree::rebalance()
+{
+    DVLOG(5) << "Priority space exhausted, redistributing priorities";
+
+    if (root.prioritiesNeeded() > maxPriority - minPriority + 1u) {
+        LOG(ERROR) << "Trace tree requires more priorities than available, "
+                      "some rules will overlap";
+    }
+    root.assignPriorities(minPriority, maxPriority);
+    m_rebalance = false;
+}
+
+void BuildFTContext::append(OFMsg* msg)
+{
+    uint8_t* buf = msg->pack();
+    out.insert(out.end(), buf, buf + msg->length());
+    OFMsg::free_buffer(buf);
+
+    ++rules;
+    if (ofconn && out.size() >= flushThreshold)
+        flush();
+}
+
+void BuildFTContext::flush()
+{
+    if (ofconn && not out.empty()) {
+        pacer->send(ofconn, out.data(), out.size(), rules - flushed);
+        flushed = rules;
+        out.clear();
+    }
+}
+
+void BuildFTContext::emitRule(TraceTreeNode* t, uint16_t priority)
+{
+    of13::FlowMod* fm = t->leaf->fm;
+    fm->table_id(table);
+    fm->priority(priority);
+
+    // Leaf sharing a rule before gets one of its own
+    if (t->leaf->owner) {
+        t->leaf->owner = 0;
+        t->leaf->index->touch(t->leaf);
+    }
+
+    delete t->leaf->packed;
+    t->leaf->packed = nullptr;
+    delete t->leaf->matches;
+    t->leaf->matches = nullptr;
+
+    bool first = true;
+    forEachRangeValue([&]() {
+        if (first) {
+            fm->match(makeMatch());
+            first = false;
+        } else {
+            if (not t->leaf->matches)
+                t->leaf->matches = new std::vector<of13::Match>();
+            t->leaf->matches->push_back(makeMatch());
+        }
+    });
+
+    append(fm);
+
+    // Buffered packet is released by the first installation only
+    fm->buffer_id(OFP_NO_BUFFER);
+
+    if (t->leaf->matches) {
+        of13::Match m = fm->match();
+        for (auto& extra : *t->leaf->matches) {
+            fm->match(extra);
+            append(fm);
+        }
+        fm->match(m);
+    }
+}
+
+void BuildFTContext::emitMerged(TraceTreeNode* t, TraceTreeNode* leaf)
+{
+    DVLOG(10) << "Merging leaves into a single rule";
+    emitRule(leaf, t->m_prio_lo);
+    t->m_compressed = true;
+
+    // Other leaves reinstall the same rule under their own cookies
+    forEachLeaf(t, [&](TraceTreeNode* other) {
+        if (other == leaf)
+            return;
+        ++merged;
+        copyRule(leaf, other);
+    });
+}
+
+bool BuildFTContext::omitBarrier(TraceTreeNode* child)
+{
+    // Packets are sent to the controller by the barrier only when
+    // they fall through rules of the subtree
+    if (not lookup(child).covered)
+        return false;
+    ++omitted;
+    return true;
+}
+
+BuildFTContext::Summary BuildFTContext::analyze(TraceTreeNode* t)
+{
+    Summary ret{false, nullptr};
+
+    switch (t->type()) {
+    case TraceTreeNode::Leaf:
+        // Rules that never expire are never reinstalled separately
+        if (isPermanent(t))
+            ret = Summary{true, t};
+        break;
+    case TraceTreeNode::Test:
+    case TraceTreeNode::Range: {
+        bool test = t->m_type == TraceTreeNode::Test;
+        Summary neg = analyze(test ? t->test.negativeChild : t->range.negativeChild);
+        Summary pos = analyze(test ? t->test.positiveChild : t->range.positiveChild);
+
+        // Holes of the positive branch are covered by the barrier
+        ret.covered = neg.covered;
+        if (neg.merged && pos.merged && sameRule(neg.merged, pos.merged))
+            ret.merged = neg.merged;
+        break;
+    }
+    case TraceTreeNode::Prefix:
+        ret = analyze(t->prefix.children[0]);
+        for (size_t i = 0; i < t->prefix.set->size(); ++i) {
+            Summary child = analyze(t->prefix.children[i + 1]);
+            if (not (ret.merged && child.merged && sameRule(ret.merged, child.merged)))
+                ret.merged = nullptr;
+        }
+        break;
+    case TraceTreeNode::Load:
+        // Packets with other values go to the controller
+        for (TraceTreeNode::LoadData* l = &t->load; l; l = l->next)
+            analyze(l->child);
+        break;
+    case TraceTreeNode::Empty:
+        break;
+    }
+
+    summary[t] = ret;
+    return ret;
+}
+
+unsigned BuildFTContext::shapeOf(TraceTreeNode* t)
+{
+    std::string key(1, char(t->type()));
+    unsigned cost = 0;
+    auto add = [&](TraceTreeNode* child) {
+        unsigned id = shapeOf(child);
+        key.append(reinterpret_cast<const char*>(&id), sizeof(id));
+        return shapeRules[id];
+    };
+
+    switch (t->m_type) {
+    case TraceTreeNode::Leaf:
+        key += ruleKey(t);
+        cost = 1;
+        break;
+    case TraceTreeNode::Test:
+        key += t->test.value.key();
+        cost = add(t->test.negativeChild) + 1 + add(t->test.positiveChild);
+        break;
+    case TraceTreeNode::Range: {
+        uint16_t bounds[2] = { t->range.lo, t->range.hi };
+        key += char(t->range.field);
+        key.append(reinterpret_cast<const char*>(bounds), sizeof(bounds));
+        cost = add(t->range.negativeChild);
+        cost += (1 + add(t->range.positiveChild)) * t->range.values->size();
+        break;
+    }
+    case TraceTreeNode::Prefix:
+        cost = add(t->prefix.children[0]);
+        for (size_t i = 0; i < t->prefix.set->size(); ++i) {
+            key += CompactTLV(t->prefix.set->tlv(i)).key();
+            key += char(t->prefix.set->length(i));
+            cost += 1 + add(t->prefix.children[i + 1]);
+        }
+        break;
+    case TraceTreeNode::Load:
+        for (TraceTreeNode::LoadData* l = &t->load; l; l = l->next) {
+            key += l->value.key();
+            cost += add(l->child);
+        }
+        break;
+    case TraceTreeNode::Empty:
+        break;
+    }
+
+    auto it = shapes.emplace(std::move(key), shapes.size()).first;
+    if (it->second == shapeRules.size())
+        shapeRules.push_back(cost);
+    shape[t] = it->second;
+    return it->second;
+}
+
+bool BuildFTContext::factor(TraceTreeNode* t)
+{
+    if (shape.empty() || table + 2 > lastTable)
+        return false;
+
+    // Every branch costs a rule in this table, but each distinct
+    // subtree is installed into the next table only once
+    unsigned flat = 0, factored = 0;
+    std::unordered_set<unsigned> seen;
+    for (TraceTreeNode::LoadData* l = &t->load; l; l = l->next) {
+        if (l->child->m_type == TraceTreeNode::Empty)
+            continue;
+        unsigned id = shape.at(l->child);
+        flat += shapeRules[id];
+        factored += 1;
+        if (seen.insert(id).second)
+            factored += shapeRules[id];
+    }
+    return factored < flat;
+}
+
+void BuildFTContext::enterGroup(uint32_t group)
+{
+    // Metadata stands for the path leading to the group
+    match.clear();
+    ranges.clear();
+    of13::Metadata metadata(group);
+    match.push_back(CompactTLV(&metadata));
+    table += 2;
+}
+
+void BuildFTContext::buildGroup(TraceTreeNode* child, const CompactTLV& value)
+{
+    // augment() allocates a group when the branch gets its first leaf
+    child->m_group = 0;
+    if (child->m_type == TraceTreeNode::Empty)
+        return;
+
+    uint64_t key = uint64_t(table) << 32 | shape.at(child);
+    auto it = groups.find(key);
+    bool first = (it == groups.end());
+    if (first)
+        it = groups.emplace(key, Group{++lastGroup, child}).first;
+    child->m_group = it->second.id;
+
+    match.push_back(value);
+    emitGoTo(child->m_prio_lo, child->m_group);
+    match.pop_back();
+
+    if (first) {
+        auto saved_match = match;
+        auto saved_ranges = ranges;
+        enterGroup(child->m_group);
+        buildFlowTableStep(child);
+        table -= 2;
+        match = saved_match;
+        ranges = saved_ranges;
+    } else {
+        // Shared subtrees can't be changed incrementally
+        copyRules(it->second.first, child);
+        it->second.first->m_compressed = true;
+        child->m_compressed = true;
+    }
+}
+
+void BuildFTContext::emitGoTo(uint16_t priority, uint32_t group)
 {
-    DVLOG(10) << "Emitting barrier";
     of13::FlowMod fm;
-    of13::Match m;
-    for (of13::OXMTLV* tlv : match_combine())
-        m.add_oxm_field(tlv->clone());
-    fm.match(m);
+    fm.table_id(table);
+    fm.command(of13::OFPFC_ADD);
+    fm.priority(priority);
+    fm.buffer_id(OFP_NO_BUFFER);
+    fm.cookie(flowCookieBase);
+    of13::WriteMetadata write_metadata(group, groupMask);
+    fm.add_instruction(write_metadata);
+    of13::GoToTable go_to_group(table + 2);
+    fm.add_instruction(go_to_group);
+
+    forEachRangeValue([&]() {
+        fm.match(makeMatch());
+        append(&fm);
+    });
+}
 
-    fm.table_id(1);
+void BuildFTContext::emitBarrier(uint16_t priority)
+{
+    DVLOG(10) << "Emitting barrier";
+    of13::FlowMod fm;
+    fm.table_id(table);
     fm.command(of13::OFPFC_ADD);
     fm.priority(priority);
     fm.buffer_id(OFP_NO_BUFFER);
     fm.cookie(flowCookieBase);
     fm.instructions(toController);
 
-    uint8_t* buf = fm.pack();
-    ofconn->send(buf, fm.length());
-    OFMsg::free_buffer(buf);
-
-    return flowCookieBase;
+    forEachRangeValue([&]() {
+        fm.match(makeMatch());
+        append(&fm);
+    });
 }
 
 void BuildFTContext::buildFlowTableStep(TraceTreeNode* t)
 {
+    bool omit;
+    t->m_compressed = false;
+    if (TraceTreeNode* leaf = lookup(t).merged) {
+        if (t->m_type != TraceTreeNode::Leaf) {
+            emitMerged(t, leaf);
+            return;
+        }
+    }
+
     switch (t->type()) {
     case TraceTreeNode::Empty:
         break;
-    case TraceTreeNode::Leaf: {
-        Flow* flow = t->leaf.flow;
-        of13::FlowMod* fm = t->leaf.fm;
-
-        emitRule(flow, fm);
-        priority += 1;
+    case TraceTreeNode::Leaf:
+        // Evicted and expired rules are installed on the next miss
+        if (t->leaf->flow->state() != Flow::Shadowed)
+            emitRule(t, t->m_prio_lo);
         break;
-    }
     case TraceTreeNode::Load:
+        t->m_factored = factor(t);
         for (TraceTreeNode::LoadData* l = &t->load; l; l = l->next) {
+            if (t->m_factored) {
+                buildGroup(l->child, l->value);
+                continue;
+            }
             match.push_back(l->value);
             buildFlowTableStep(l->child);
             match.pop_back();
@@ -169,110 +954,338 @@ void BuildFTContext::buildFlowTableStep(TraceTreeNode* t)
 
         // Barrier
         match.push_back(t->test.value);
-        emitBarrier();
-        priority += 1;
+        omit = omitBarrier(t->test.positiveChild);
+        if (not omit)
+            emitBarrier(t->barrierPriority());
 
         buildFlowTableStep(t->test.positiveChild);
+        t->test.positiveChild->m_compressed |= omit;
         match.pop_back();
 
+        break;
+    case TraceTreeNode::Range:
+        buildFlowTableStep(t->range.negativeChild);
+
+        // Positive branch is repeated for every value covering the range
+        ranges.push_back(t->range.values);
+        omit = omitBarrier(t->range.positiveChild);
+        if (not omit)
+            emitBarrier(t->barrierPriority());
+        buildFlowTableStep(t->range.positiveChild);
+        t->range.positiveChild->m_compressed |= omit;
+        ranges.pop_back();
+        break;
+    case TraceTreeNode::Prefix: {
+        // Longer prefixes are placed above, each one under its barrier
+        const PrefixSet* set = t->prefix.set;
+        buildFlowTableStep(t->prefix.children[0]);
+
+        for (size_t i = 0; i < set->size(); ++i) {
+            TraceTreeNode* child = t->prefix.children[i + 1];
+            match.push_back(CompactTLV(set->tlv(i)));
+            omit = omitBarrier(child);
+            if (not omit)
+                emitBarrier(t->barrierPriority(i));
+            buildFlowTableStep(child);
+            child->m_compressed |= omit;
+            match.pop_back();
+        }
         break;
     }
+    }
 }
 
 TraceTreeNode::Type TraceTreeNode::type()
 {
-    if (m_type == Leaf && leaf.flow->outdated()) {
-        assert(leaf.flow->state() != Flow::New);
-        leaf.flow->setDestroy();
+    if (m_type == Leaf && leaf->flow->outdated()) {
+        assert(leaf->flow->state() != Flow::New);
+        leaf->flow->setDestroy();
         makeEmpty();
     }
     return m_type;
 }
 
-void TraceTreeNode::makeEmpty()
+TraceTreeNode::Type TraceTreeNode::liveType()
+{
+    if (m_type == Leaf && leaf->flow->outdated())
+        return Empty;
+    return m_type;
+}
+
+static void destroyChild(TraceTreeNode* t, TraceTreeStorage* storage)
+{
+    if (storage)
+        storage->destroyNode(t);
+    else
+        t->~TraceTreeNode();
+}
+
+void TraceTreeNode::makeEmpty(TraceTreeStorage* storage)
 {
     switch (m_type) {
     case Empty:
         break;
     case Test:
-        delete test.value;
-        delete test.negativeChild;
-        delete test.positiveChild;
+        destroyChild(test.negativeChild, storage);
+        destroyChild(test.positiveChild, storage);
         break;
     case Load:
-        delete load.value;
-        for (LoadData *l = load.next, *p = nullptr;
-             l != nullptr;
-             l = l->next) {
-            p = l;
-            delete p->value;
-            delete p;
+        delete load.index;
+        destroyChild(load.child, storage);
+        for (LoadData* l = load.next; l != nullptr; ) {
+            LoadData* next = l->next;
+            destroyChild(l->child, storage);
+            if (storage)
+                storage->destroyBranch(l);
+            l = next;
         }
         break;
+    case Range:
+        delete range.values;
+        destroyChild(range.negativeChild, storage);
+        destroyChild(range.positiveChild, storage);
+        break;
+    case Prefix:
+        for (size_t i = 0; i <= prefix.set->size(); ++i)
+            destroyChild(prefix.children[i], storage);
+        delete[] prefix.children;
+        delete prefix.set;
+        break;
     case Leaf:
-        leaf.flow->deleteLater();
-        delete leaf.fm;
+        // Lookups of other threads may still hold the leaf
+        leaf->index->unlink(leaf);
+        leaf->index->cookies.erase(leaf->fm->cookie());
+        leaf->index->retired.push_back(leaf);
         break;
     }
 
     m_type = Empty;
 }
 
-void TraceTreeNode::makeTest(of13::OXMTLV *value)
+bool TraceTreeNode::prune(TraceTreeStorage& storage, CompiledTraceTree* compiled)
+{
+    switch (type()) {
+    case Empty:
+        return true;
+    case Leaf:
+        return false;
+    case Test: {
+        bool negative = test.negativeChild->prune(storage, compiled);
+        bool positive = test.positiveChild->prune(storage, compiled);
+        if (not (negative && positive))
+            return false;
+        break;
+    }
+    case Range: {
+        bool negative = range.negativeChild->prune(storage, compiled);
+        bool positive = range.positiveChild->prune(storage, compiled);
+        if (not (negative && positive))
+            return false;
+        break;
+    }
+    case Prefix: {
+        bool empty = true;
+        for (size_t i = 0; i <= prefix.set->size(); ++i)
+            empty &= prefix.children[i]->prune(storage, compiled);
+        if (not empty)
+            return false;
+        break;
+    }
+    case Load: {
+        for (LoadData *p = &load, *l = load.next; l != nullptr; l = p->next) {
+            if (not l->child->prune(storage, compiled)) {
+                p = l;
+                continue;
+            }
+            if (compiled)
+                compiled->pruneBranch(this, l->value);
+            if (load.index)
+                load.index->children.erase(l->value.key());
+            p->next = l->next;
+            storage.destroyNode(l->child);
+            storage.destroyBranch(l);
+        }
+        if (not load.child->prune(storage, compiled))
+            return false;
+        if (load.next == nullptr)
+            break;
+
+        // Head branch is kept in the node, the next one takes its place
+        LoadData* next = load.next;
+        if (compiled)
+            compiled->pruneBranch(this, load.value);
+        if (load.index)
+            load.index->children.erase(load.value.key());
+        storage.destroyNode(load.child);
+        load.value = next->value;
+        load.child = next->child;
+        load.next = next->next;
+        storage.destroyBranch(next);
+        return false;
+    }
+    }
+
+    if (compiled)
+        compiled->pruneNode(this);
+    makeEmpty(&storage);
+    return true;
+}
+
+void TraceTreeNode::makeTest(const CompactTLV& value, TraceTreeStorage& storage)
 {
     CHECK_EQ(m_type, Empty);
-    test.positiveChild = new TraceTreeNode();
-    test.negativeChild = new TraceTreeNode();
-    test.value = value->clone();
+    test.positiveChild = storage.makeNode();
+    test.negativeChild = storage.makeNode();
+    test.value = value;
     m_type = Test;
+
+    splitPriorities(test.negativeChild, test.positiveChild);
 }
 
-void TraceTreeNode::makeLoad(of13::OXMTLV* value)
+void TraceTreeNode::makeRange(uint8_t field, uint16_t lo, uint16_t hi,
+                              TraceTreeStorage& storage)
+{
+    CHECK_EQ(m_type, Empty);
+    range.values = new std::vector<CompactTLV>();
+    for (of13::OXMTLV* value : expandPortRange(field, lo, hi)) {
+        range.values->push_back(CompactTLV(value));
+        delete value;
+    }
+    range.positiveChild = storage.makeNode();
+    range.negativeChild = storage.makeNode();
+    range.lo = lo;
+    range.hi = hi;
+    range.field = field;
+    m_type = Range;
+
+    splitPriorities(range.negativeChild, range.positiveChild);
+}
+
+void TraceTreeNode::splitPriorities(TraceTreeNode* negative, TraceTreeNode* positive)
+{
+    // Negative branch goes below the barrier, positive one above it.
+    // When there is no room left the tree should be rebalanced.
+    if (m_prio_hi - m_prio_lo >= 2) {
+        uint16_t barrier = m_prio_lo + (m_prio_hi - m_prio_lo) / 2;
+        negative->setPriorities(m_prio_lo, barrier - 1);
+        positive->setPriorities(barrier + 1, m_prio_hi);
+    } else {
+        negative->setPriorities(m_prio_lo, m_prio_lo);
+        positive->setPriorities(m_prio_hi, m_prio_hi);
+    }
+}
+
+void TraceTreeNode::makeLoad(const CompactTLV& value, TraceTreeStorage& storage)
 {
     CHECK_EQ(m_type, Empty);
     load.next = nullptr;
-    load.child = new TraceTreeNode();
-    load.value = value->clone();
+    load.index = nullptr;
+    load.child = storage.makeNode();
+    load.child->setPriorities(m_prio_lo, m_prio_hi);
+    load.value = value;
+    m_factored = false;
     m_type = Load;
 }
 
-void TraceTreeNode::makeLeaf(Flow *flow, of13::FlowMod* fm_base)
+void TraceTreeNode::makePrefix(const PrefixSet& set, TraceTreeStorage& storage)
 {
     CHECK_EQ(m_type, Empty);
-    leaf.flow = flow;
-    leaf.fm = fm_base;
+    prefix.set = new PrefixSet(set);
+    prefix.children = new TraceTreeNode*[set.size() + 1];
+    for (size_t i = 0; i <= set.size(); ++i)
+        prefix.children[i] = storage.makeNode();
+    m_type = Prefix;
+
+    layoutPrefix(m_prio_lo, m_prio_hi);
+}
+
+void TraceTreeNode::makeLeaf(Flow *flow, of13::FlowMod* fm_base, TraceTreeStorage& storage,
+                             LeafIndex& index)
+{
+    CHECK_EQ(m_type, Empty);
+    leaf = storage.makeLeaf();
+    leaf->flow = flow;
+    leaf->fm = fm_base;
+    leaf->index = &index;
+    leaf->matches = nullptr;
+    leaf->packed = nullptr;
+    leaf->packets = 0;
+    index.cookies[fm_base->cookie()] = this;
     m_type = Leaf;
 }
 
-TraceTreeNode* TraceTreeNode::move(TraceEntry &op)
+TraceTreeNode* TraceTreeNode::move(TraceEntry &op, TraceTreeStorage& storage)
 {
     switch (type()) {
     case Test: {
         DVLOG(10) << "moving by test branch";
         CHECK_EQ(op.type, TraceEntry::Test);
-        CHECK_EQ(test.value->field(), op.tlv->field());
+        CHECK_EQ(test.value.field, op.value.field);
         return op.outcome ? test.positiveChild : test.negativeChild;
     }
     case Load: {
         DVLOG(10) << "moving by load branch";
         CHECK_EQ(op.type, TraceEntry::Load);
-        CHECK_EQ(load.value->field(), op.tlv->field());
-
-        // Add new element to the list
-        LoadData *l, *p;
-        for (l = &load, p = nullptr;
-             l != nullptr;
-             p = l, l = l->next)
-        {
-            if (l->value->equals(*op.tlv))
-                return l->child;
+        CHECK_EQ(load.value.field, op.value.field);
+
+        // Packed values are equal iff tlvs are equal
+        const CompactTLV& value = op.value;
+        std::string key;
+        if (load.index) {
+            key = value.key();
+            auto it = load.index->children.find(key);
+            if (it != load.index->children.end())
+                return it->second;
         }
 
-        if (l == nullptr) {
-            l = p->next = new LoadData();
-            l->value = op.tlv->clone();
-            return l->child = new TraceTreeNode();
+        // Add new element to the list. Order of exact values doesn't
+        // matter, so indexed node inserts them right after the head.
+        LoadData *l, *p = &load;
+        unsigned branches = 0;
+        if (not load.index || load.index->masked || value.masked) {
+            for (l = &load, p = nullptr;
+                 l != nullptr;
+                 p = l, l = l->next, ++branches)
+            {
+                if (not load.index && l->value == value)
+                    return l->child;
+            }
         }
+
+        // Branches are disjoint, so they share the priority space
+        l = storage.makeBranch();
+        l->next = p->next;
+        p->next = l;
+        l->value = value;
+        l->child = storage.makeNode();
+        l->child->setPriorities(m_prio_lo, m_prio_hi);
+
+        if (load.index) {
+            load.index->children.emplace(std::move(key), l->child);
+            load.index->masked |= l->value.masked;
+        } else if (branches + 1 >= loadIndexThreshold) {
+            DVLOG(10) << "indexing load node with " << branches + 1 << " branches";
+            load.index = new LoadIndex();
+            load.index->masked = false;
+            for (LoadData* i = &load; i != nullptr; i = i->next) {
+                load.index->children.emplace(i->value.key(), i->child);
+                load.index->masked |= i->value.masked;
+            }
+        }
+        return l->child;
+    }
+    case Range: {
+        DVLOG(10) << "moving by range branch";
+        CHECK_EQ(op.type, TraceEntry::Range);
+        CHECK_EQ(range.field, op.value.field);
+        CHECK(range.lo == op.range_lo && range.hi == op.range_hi);
+        return op.outcome ? range.positiveChild : range.negativeChild;
+    }
+    case Prefix: {
+        DVLOG(10) << "moving by prefix branch";
+        CHECK_EQ(op.type, TraceEntry::Prefix);
+        CHECK(*prefix.set == *op.prefixes);
+        return prefix.children[op.index + 1];
     }
     default:
         return nullptr;
@@ -281,37 +1294,232 @@ TraceTreeNode* TraceTreeNode::move(TraceEntry &op)
 
 void TraceTree::augment(Flow* flow, of13::FlowMod* fm_base)
 {
+    QWriteLocker lock(&m_lock);
     TraceTreeNode* t = &root;
+    BuildFTContext ctx(nullptr, nullptr, m_pending, m_table);
+    // Root of the subtree created by this trace
+    TraceTreeNode* created = nullptr;
 
     for (auto& op : flow->trace()) {
-        DVLOG(10) << "augment step, item type = " << op.type << " " << ::dump(op.tlv);
+        DVLOG(10) << "augment step, item type = " << op.type << " " << dumpValue(op.value);
+
+        // Compressed rules don't leave room for incremental changes
+        if (t->m_compressed)
+            m_rebuild = true;
 
         if (t->type() == TraceTreeNode::Empty) {
             DVLOG(10) << "appending this item to the tree";
+            if (created == nullptr)
+                created = t;
+
+            uint8_t field = op.value.field;
+            auto pos = std::lower_bound(m_fields.begin(), m_fields.end(), field);
+            if (pos == m_fields.end() || *pos != field)
+                m_fields.insert(pos, field);
 
             if (op.type == TraceEntry::Test) {
-                t->makeTest(op.tlv);
+                t->makeTest(op.value, m_storage);
+
+                if (t->m_prio_hi - t->m_prio_lo < 2) {
+                    m_rebalance = true;
+                } else {
+                    ctx.match.push_back(t->test.value);
+                    ctx.emitBarrier(t->barrierPriority());
+                    ctx.match.pop_back();
+                }
             } else if (op.type == TraceEntry::Load) {
-                t->makeLoad(op.tlv);
+                t->makeLoad(op.value, m_storage);
+            } else if (op.type == TraceEntry::Range) {
+                t->makeRange(op.value.field, op.range_lo, op.range_hi, m_storage);
+
+                if (t->m_prio_hi - t->m_prio_lo < 2) {
+                    m_rebalance = true;
+                } else {
+                    ctx.ranges.push_back(t->range.values);
+                    ctx.emitBarrier(t->barrierPriority());
+                    ctx.ranges.pop_back();
+                }
+            } else if (op.type == TraceEntry::Prefix) {
+                t->makePrefix(*op.prefixes, m_storage);
+
+                if (t->prioritiesNeeded() > t->m_prio_hi - t->m_prio_lo + 1u) {
+                    m_rebalance = true;
+                } else {
+                    const PrefixSet* set = t->prefix.set;
+                    for (size_t i = 0; i < set->size(); ++i) {
+                        ctx.match.push_back(CompactTLV(set->tlv(i)));
+                        ctx.emitBarrier(t->barrierPriority(i));
+                        ctx.match.pop_back();
+                    }
+                }
             }
         }
 
-        t = t->move(op);
+        TraceTreeNode* next = t->move(op, m_storage);
+        switch (t->m_type) {
+        case TraceTreeNode::Load: {
+            const CompactTLV& value = op.value;
+            if (t->m_factored) {
+                if (next->m_group == 0) {
+                    next->m_group = ++m_groups;
+                    ctx.match.push_back(value);
+                    ctx.emitGoTo(next->m_prio_lo, next->m_group);
+                    ctx.match.pop_back();
+                }
+                ctx.enterGroup(next->m_group);
+            } else {
+                ctx.match.push_back(value);
+            }
+            if (m_compiled && created == nullptr &&
+                    next->m_compiled == TraceTreeNode::notCompiled)
+                m_compiled->addBranch(t, value, next);
+            break;
+        }
+        case TraceTreeNode::Test:
+            if (op.outcome)
+                ctx.match.push_back(t->test.value);
+            break;
+        case TraceTreeNode::Range:
+            if (op.outcome)
+                ctx.ranges.push_back(t->range.values);
+            break;
+        case TraceTreeNode::Prefix:
+            if (op.outcome)
+                ctx.match.push_back(CompactTLV(t->prefix.set->tlv(op.index)));
+            break;
+        default:
+            break;
+        }
+        t = next;
     }
 
     CHECK(t->type() == TraceTreeNode::Empty);
-    t->makeLeaf(flow, fm_base);
+    fm_base->cookie(m_leaves.allocate(flowCookieBase));
+    t->makeLeaf(flow, fm_base, m_storage, m_leaves);
+    m_leaves.touch(t->leaf);
+    t->leaf->batch = m_batch;
+
+    if (m_compiled)
+        m_compiled->update(created ? created : t);
+
+    if (t->m_compressed)
+        m_rebuild = true;
+    if (not m_rebalance && not m_rebuild)
+        ctx.emitRule(t, t->m_prio_lo);
+    m_pending_rules += ctx.rules;
+}
+
+TraceTreeNode::LeafData* TraceTree::reinstall(TraceTreeNode::LeafData* leaf,
+                                              OFConnection* ofconn,
+                                              uint32_t xid, uint32_t buffer_id)
+{
+    QWriteLocker lock(&m_lock);
+    // Leaf could be removed by another thread since the lookup
+    if (not m_leaves.cookies.count(leaf->fm->cookie()))
+        return nullptr;
+
+    if (leaf->owner) {
+        TraceTreeNode::LeafData* owner = findLeaf(leaf->owner);
+        if (owner == nullptr) {
+            // Rule is emitted again with a new owner
+            m_rebuild = true;
+            return nullptr;
+        }
+        leaf = owner;
+    }
+    uint16_t hard_timeout = leaf->flow->hardTimeout();
+
+    of13::FlowMod* fm = leaf->fm;
+    unsigned rules = 1 + (leaf->matches ? leaf->matches->size() : 0);
+    m_leaves.touch(leaf);
+    leaf->packets = 0;
+    makeRoom(ofconn, rules);
+    m_occupancy += rules;
+
+    if (not leaf->packed) {
+        // Buffer id of the copies for range paths is never patched
+        fm->buffer_id(OFP_NO_BUFFER);
+        auto packed = new std::vector<uint8_t>();
+        auto append = [packed](of13::FlowMod* msg) {
+            uint8_t* buf = msg->pack();
+            packed->insert(packed->end(), buf, buf + msg->length());
+            OFMsg::free_buffer(buf);
+        };
+
+        append(fm);
+        if (leaf->matches) {
+            of13::Match m = fm->match();
+            for (auto& extra : *leaf->matches) {
+                fm->match(extra);
+                append(fm);
+            }
+            fm->match(m);
+        }
+        leaf->packed = packed;
+    }
+
+    // Only the fields differing between installations are changed
+    std::vector<uint8_t>& packed = *leaf->packed;
+    MessageTemplate::set32(packed.data(), MessageTemplate::flowModBufferId, buffer_id);
+    for (size_t offset = 0; offset < packed.size(); ) {
+        uint8_t* msg = &packed[offset];
+        MessageTemplate::setXid(msg, xid);
+        MessageTemplate::set16(msg, MessageTemplate::flowModHardTimeout, hard_timeout);
+        uint16_t len_n;
+        memcpy(&len_n, msg + 2, sizeof(len_n));
+        offset += ntoh16(len_n);
+    }
+
+    m_pacer.send(ofconn, packed.data(), packed.size(), rules);
+    return leaf;
 }
 
 std::ostream& TraceTree::dump(std::ostream& out)
 {
+    QReadLocker lock(&m_lock);
     return root.dump(out, 0);
 }
 
+void TraceTree::quiesce()
+{
+    {
+        QReadLocker lock(&m_lock);
+        if (m_leaves.retired.empty())
+            return;
+    }
+
+    QWriteLocker lock(&m_lock);
+    for (auto leaf : m_leaves.retired)
+        m_storage.releaseLeaf(leaf);
+    m_leaves.retired.clear();
+}
+
 void TraceTree::clear()
 {
+    QWriteLocker lock(&m_lock);
     root.~TraceTreeNode();
     root.m_type = TraceTreeNode::Empty;
+    root.m_compressed = false;
+    m_leaves.cookies.clear();
+    m_leaves.oldest = m_leaves.newest = nullptr;
+    // Leaves can't be found after the connection is closed
+    for (auto leaf : m_leaves.retired)
+        m_storage.releaseLeaf(leaf);
+    m_leaves.retired.clear();
+    m_storage.clear();
+    m_fields.clear();
+    if (m_compiled)
+        m_compiled->invalidate();
+
+    m_pending.clear();
+    m_pending_rules = 0;
+    m_pacer.reset();
+    m_rebalance = false;
+    m_rebuild = false;
+    m_groups = 0;
+    m_occupancy = 0;
+    ++m_batch;
+    m_table = firstTable;
 }
 
 std::ostream& TraceTreeNode::dump(std::ostream& out, size_t level)
@@ -320,18 +1528,33 @@ std::ostream& TraceTreeNode::dump(std::ostream& out, size_t level)
 
     switch (m_type) {
     case Leaf:
-        out << indent << "Leaf " << leaf.flow << std::endl;
+        out << indent << "Leaf " << leaf->flow << std::endl;
         break;
     case Test:
-        out << indent << "Test " << ::dump(test.value) << std::endl;
+        out << indent << "Test " << dumpValue(test.value) << std::endl;
         test.positiveChild->dump(out, level + 1);
         test.negativeChild->dump(out, level + 1);
         break;
     case Load:
         for (LoadData* l = &load; l != nullptr; l = l->next) {
-            out << indent << "Load " << ::dump(l->value) << std::endl;
+            out << indent << "Load " << dumpValue(l->value) << std::endl;
             l->child->dump(out, level + 1);
         }
+        break;
+    case Range:
+        out << indent << "Range " << (int) range.field << " "
+            << range.lo << "-" << range.hi << std::endl;
+        range.positiveChild->dump(out, level + 1);
+        range.negativeChild->dump(out, level + 1);
+        break;
+    case Prefix:
+        out << indent << "Prefix none" << std::endl;
+        prefix.children[0]->dump(out, level + 1);
+        for (size_t i = 0; i < prefix.set->size(); ++i) {
+            out << indent << "Prefix " << ::dump(prefix.set->tlv(i)) << std::endl;
+            prefix.children[i + 1]->dump(out, level + 1);
+        }
+        break;
     case Empty:
         break;
     }
@@ -341,33 +1564,68 @@ std::ostream& TraceTreeNode::dump(std::ostream& out, size_t level)
 
 TraceTreeNode::LeafData* TraceTree::find(Packet* pkt)
 {
+    QReadLocker lock(&m_lock);
+    if (m_compiled && not m_compiled->valid()) {
+        // Compilation changes the tree
+        lock.unlock();
+        QWriteLocker write(&m_lock);
+        // Compiled tree could be disabled while the lock was released
+        if (m_compiled)
+            return m_compiled->find(&root, pkt);
+        return root.find(pkt);
+    }
+
+    if (m_compiled)
+        return m_compiled->find(&root, pkt);
     return root.find(pkt);
 }
 
 TraceTreeNode::LeafData* TraceTreeNode::find(Packet* pkt)
 {
-    switch (type()) {
+    switch (liveType()) {
     case Leaf:
-        return &leaf;
+        return leaf;
     case Test: {
-        OXMTLVUnion data(test.value->field());
+        OXMTLVUnion data(test.value.field);
         pkt->read(data);
 
-        bool res = oxm_match(test.value, data.base());
+        bool res = test.value.match(data.base());
         TraceTreeNode* child = res ? test.positiveChild : test.negativeChild;
         if (child) return child->find(pkt);
     }
     case Load: {
-        OXMTLVUnion data(load.value->field());
+        OXMTLVUnion data(load.value.field);
         pkt->read(data);
 
+        if (load.index && not load.index->masked) {
+            auto it = load.index->children.find(CompactTLV(data.base()).key());
+            if (it == load.index->children.end())
+                return nullptr;
+            return it->second->find(pkt);
+        }
+
         for (LoadData* l = &load; l != nullptr; l = l->next) {
-            if (oxm_match(l->value, data.base()))
+            if (l->value.match(data.base()))
                 return l->child->find(pkt);
         }
 
         return nullptr;
     }
+    case Range: {
+        OXMTLVUnion data(range.field);
+        pkt->read(data);
+
+        uint16_t port = portValue(data.base());
+        bool res = range.lo <= port && port <= range.hi;
+        return (res ? range.positiveChild : range.negativeChild)->find(pkt);
+    }
+    case Prefix: {
+        OXMTLVUnion data(prefix.set->field());
+        pkt->read(data);
+
+        int i = prefix.set->lookup(data.base());
+        return prefix.children[i + 1]->find(pkt);
+    }
     default:
         return nullptr;
     }
@@ -375,43 +1633,257 @@ TraceTreeNode::LeafData* TraceTreeNode::find(Packet* pkt)
 
 Flow* TraceTree::find(uint64_t cookie)
 {
-    return root.find(cookie);
+    QReadLocker lock(&m_lock);
+    TraceTreeNode::LeafData* ret = findLeaf(cookie);
+    return ret ? ret->flow : nullptr;
 }
 
-Flow* TraceTreeNode::find(uint64_t cookie)
+TraceTreeNode::LeafData* TraceTree::leaf(uint64_t cookie)
 {
-    switch (type()) {
-    case Leaf:
-        if (leaf.fm->cookie() == cookie)
-            return leaf.flow;
-        else
-            return nullptr;
-    case Test: {
-        auto ret = test.negativeChild->find(cookie);
-        if (ret != nullptr)
-            return ret;
+    QReadLocker lock(&m_lock);
+    return findLeaf(cookie);
+}
 
-        return test.positiveChild->find(cookie);
-    }
+TraceTreeNode::LeafData* TraceTree::findLeaf(uint64_t cookie)
+{
+    auto it = m_leaves.cookies.find(cookie);
+    if (it == m_leaves.cookies.end())
+        return nullptr;
+
+    // Outdated leaf is removed by the next change of the tree
+    TraceTreeNode* t = it->second;
+    if (t->liveType() != TraceTreeNode::Leaf)
+        return nullptr;
+
+    return t->leaf;
+}
+
+void TraceTree::fields(std::vector<uint8_t>& out) const
+{
+    QReadLocker lock(&m_lock);
+    out.assign(m_fields.begin(), m_fields.end());
+}
+
+void TraceTreeNode::setPriorities(uint16_t lo, uint16_t hi)
+{
+    m_prio_lo = lo;
+    m_prio_hi = hi;
+}
+
+uint16_t TraceTreeNode::barrierPriority() const
+{
+    CHECK(m_type == Test || m_type == Range);
+    TraceTreeNode* negative = (m_type == Test) ? test.negativeChild : range.negativeChild;
+    return negative->m_prio_hi + 1;
+}
+
+unsigned TraceTreeNode::prioritiesNeeded()
+{
+    switch (type()) {
+    case Test:
+        return test.negativeChild->prioritiesNeeded() + 1 +
+               test.positiveChild->prioritiesNeeded();
+    case Range:
+        return range.negativeChild->prioritiesNeeded() + 1 +
+               range.positiveChild->prioritiesNeeded();
     case Load: {
-        for (LoadData* l = &load; l != nullptr; l = l->next) {
-            auto ret = l->child->find(cookie);
-            if (ret != nullptr)
-                return ret;
+        unsigned ret = 1;
+        for (LoadData* l = &load; l != nullptr; l = l->next)
+            ret = std::max(ret, l->child->prioritiesNeeded());
+        return ret;
+    }
+    case Prefix: {
+        // Prefixes of the same length are disjoint and share a band
+        unsigned ret = prefix.children[0]->prioritiesNeeded();
+        std::vector<unsigned> bands(33, 0);
+        for (size_t i = 0; i < prefix.set->size(); ++i) {
+            unsigned& band = bands[prefix.set->length(i)];
+            band = std::max(band, 1 + prefix.children[i + 1]->prioritiesNeeded());
         }
-        return nullptr;
+        for (unsigned band : bands)
+            ret += band;
+        return ret;
     }
     default:
-        return nullptr;
+        // Empty nodes keep a room for future leaves
+        return 1;
+    }
+}
+
+void TraceTreeNode::assignPriorities(unsigned lo, unsigned hi)
+{
+    setPriorities(lo, hi);
+
+    switch (type()) {
+    case Test:
+        assignSplit(test.negativeChild, test.positiveChild, lo, hi);
+        break;
+    case Range:
+        assignSplit(range.negativeChild, range.positiveChild, lo, hi);
+        break;
+    case Load:
+        for (LoadData* l = &load; l != nullptr; l = l->next)
+            l->child->assignPriorities(lo, hi);
+        break;
+    case Prefix:
+        layoutPrefix(lo, hi);
+        break;
+    default:
+        break;
+    }
+}
+
+uint16_t TraceTreeNode::barrierPriority(int prefix_index) const
+{
+    CHECK_EQ(m_type, Prefix);
+    const TraceTreeNode* child = prefix.children[prefix_index + 1];
+    return child->m_prio_lo > m_prio_lo ? child->m_prio_lo - 1 : m_prio_lo;
+}
+
+void TraceTreeNode::assignSplit(TraceTreeNode* negative, TraceTreeNode* positive,
+                                unsigned lo, unsigned hi)
+{
+    // Give both branches what they need and split the rest evenly
+    unsigned neg = negative->prioritiesNeeded();
+    unsigned pos = positive->prioritiesNeeded();
+    unsigned avail = hi - lo + 1;
+    if (avail < 3) {
+        negative->assignPriorities(lo, lo);
+        positive->assignPriorities(hi, hi);
+        return;
+    }
+
+    unsigned slack = avail > neg + pos + 1 ? avail - neg - pos - 1 : 0;
+    unsigned barrier = std::min(hi - 1, std::max(lo + 1, lo + neg + slack / 2));
+
+    negative->assignPriorities(lo, barrier - 1);
+    positive->assignPriorities(barrier + 1, hi);
+}
+
+void TraceTreeNode::layoutPrefix(unsigned lo, unsigned hi)
+{
+    // Band 0 is for packets matching no prefix, then goes one band per
+    // prefix length in ascending order. Each band except the first one
+    // starts with barriers of its prefixes.
+    std::vector<unsigned> need(34, 0);
+    need[0] = prefix.children[0]->prioritiesNeeded();
+    for (size_t i = 0; i < prefix.set->size(); ++i) {
+        unsigned& band = need[prefix.set->length(i) + 1];
+        band = std::max(band, 1 + prefix.children[i + 1]->prioritiesNeeded());
+    }
+
+    unsigned total = 0, nbands = 0;
+    for (unsigned n : need) {
+        total += n;
+        nbands += (n > 0);
+    }
+    unsigned avail = hi - lo + 1;
+    unsigned extra = avail > total ? (avail - total) / nbands : 0;
+
+    std::vector<unsigned> start(34, lo);
+    unsigned pos = lo;
+    for (size_t b = 0; b < need.size(); ++b) {
+        if (need[b] == 0)
+            continue;
+        start[b] = std::min(pos, hi);
+        pos += need[b] + extra;
+    }
+
+    unsigned end = hi;
+    for (size_t b = need.size(); b-- > 0; ) {
+        if (need[b] == 0)
+            continue;
+        unsigned first = std::min(b == 0 ? start[b] : start[b] + 1, end);
+        if (b == 0) {
+            prefix.children[0]->assignPriorities(first, end);
+        } else {
+            for (size_t i = 0; i < prefix.set->size(); ++i) {
+                if (prefix.set->length(i) + 1u == b)
+                    prefix.children[i + 1]->assignPriorities(first, end);
+            }
+        }
+        end = start[b] > lo ? start[b] - 1 : lo;
     }
-    return nullptr;
 }
 
 TraceTreeNode::TraceTreeNode()
-    : m_type(Empty)
+    : m_type(Empty), m_prio_lo(0), m_prio_hi(0), m_compiled(notCompiled),
+      m_compressed(false), m_factored(false), m_group(0)
 { }
 
 TraceTreeNode::~TraceTreeNode()
 {
     makeEmpty();
 }
+
+void LeafIndex::touch(TraceTreeNode::LeafData* leaf)
+{
+    unlink(leaf);
+    leaf->older = newest;
+    leaf->newer = nullptr;
+    if (newest)
+        newest->newer = leaf;
+    else
+        oldest = leaf;
+    newest = leaf;
+}
+
+void LeafIndex::unlink(TraceTreeNode::LeafData* leaf)
+{
+    if (leaf->older)
+        leaf->older->newer = leaf->newer;
+    else if (oldest == leaf)
+        oldest = leaf->newer;
+    else
+        return;
+
+    if (leaf->newer)
+        leaf->newer->older = leaf->older;
+    else
+        newest = leaf->older;
+    leaf->older = nullptr;
+    leaf->newer = nullptr;
+}
+
+TraceTreeNode* TraceTreeStorage::makeNode()
+{
+    return new (nodes.allocate()) TraceTreeNode();
+}
+
+TraceTreeNode::LoadData* TraceTreeStorage::makeBranch()
+{
+    return new (branches.allocate()) TraceTreeNode::LoadData();
+}
+
+TraceTreeNode::LeafData* TraceTreeStorage::makeLeaf()
+{
+    return new (leaves.allocate()) TraceTreeNode::LeafData();
+}
+
+void TraceTreeStorage::releaseLeaf(TraceTreeNode::LeafData* leaf)
+{
+    delete leaf->matches;
+    delete leaf->packed;
+    leaf->flow->deleteLater();
+    delete leaf->fm;
+    leaves.free(leaf);
+}
+
+void TraceTreeStorage::destroyNode(TraceTreeNode* t)
+{
+    t->makeEmpty(this);
+    t->~TraceTreeNode();
+    nodes.free(t);
+}
+
+void TraceTreeStorage::destroyBranch(TraceTreeNode::LoadData* l)
+{
+    branches.free(l);
+}
+
+void TraceTreeStorage::clear()
+{
+    // Nodes are destroyed by their parents, LoadData is trivial
+    nodes.clear();
+    branches.clear();
+}
@@ -17,37 +17,60 @@
 #pragma once
 
 #include "Common.hh"
+#include "CompactTLV.hh"
+#include "FlowModPacer.hh"
+#include "PrefixSet.hh"
+#include "Slab.hh"
+#include <chrono>
 #include <list>
 #include <stack>
 #include <ostream>
+#include <string>
+#include <unordered_map>
 
+class CompiledTraceTree;
 class Flow;
 class Packet;
+class PacketInView;
+class TraceTreeNode;
+struct TraceTreeStorage;
+
+struct LeafIndex;
 
 struct TraceEntry {
     enum Type {
         Test = 1,
-        Load = 2
+        Load = 2,
+        Prefix = 3,
+        Range = 4
     } type;
-    of13::OXMTLV* tlv;
+    // Stored inline to keep the heap out of the packet-in path
+    CompactTLV value;
     bool outcome;
+    // Longest-prefix match: set and index of the matched prefix
+    PrefixSetPtr prefixes;
+    int index;
+    // Range test bounds, inclusive
+    uint16_t range_lo;
+    uint16_t range_hi;
 
     // ctor
     TraceEntry(Type type_, const of13::OXMTLV& tlv_, bool outcome_ = false)
-            : type(type_), tlv(tlv_.clone()), outcome(outcome_) {}
+            : type(type_), value(&tlv_), outcome(outcome_), index(-1),
+              range_lo(0), range_hi(0) {}
+    TraceEntry(const of13::OXMTLV& tlv_, PrefixSetPtr prefixes_, int index_)
+            : type(Prefix), value(&tlv_), outcome(index_ >= 0),
+              prefixes(std::move(prefixes_)), index(index_),
+              range_lo(0), range_hi(0) {}
+    TraceEntry(const of13::OXMTLV& tlv_, uint16_t lo, uint16_t hi, bool outcome_)
+            : type(Range), value(&tlv_), outcome(outcome_), index(-1),
+              range_lo(lo), range_hi(hi) {}
     // default ctor
     TraceEntry() = delete;
     // copy ctor
     TraceEntry(const TraceEntry& o) = delete;
     // move ctor
-    TraceEntry(TraceEntry&& o) {
-        type = o.type;
-        tlv = o.tlv;
-        outcome = o.outcome;
-        o.tlv = nullptr;
-    }
-    // dtor
-    ~TraceEntry() { delete tlv; }
+    TraceEntry(TraceEntry&& o) = default;
 };
 
 typedef std::vector<TraceEntry> Trace;
@@ -58,63 +81,347 @@ public:
         Empty = 0,
         Test  = 1,
         Load  = 2,
-        Leaf  = 3
+        Leaf  = 3,
+        Prefix = 4,
+        Range = 5
     };
 
     Type m_type;
+    // Flow priorities reserved for rules generated by this subtree
+    uint16_t m_prio_lo;
+    uint16_t m_prio_hi;
+    // Position in the compiled tree
+    uint32_t m_compiled;
+    static const uint32_t notCompiled = 0xffffffff;
+    // Rules of this subtree were merged or its barrier omitted
+    // by the last build, so new leaves require a full rebuild
+    bool m_compressed;
+    // Branches of this Load node are installed into the next table
+    bool m_factored;
+    // Metadata value written by the rule leading to this subtree
+    // when its parent is factored, 0 otherwise
+    uint32_t m_group;
+
     Type type();
-    void makeEmpty();
-    void makeTest(of13::OXMTLV* value);
-    void makeLoad(of13::OXMTLV* value);
-    void makeLeaf(Flow* flow, of13::FlowMod* fm_base);
+    /// Type seen by lookups, which don't remove outdated leaves
+    Type liveType();
+    /// Destroys children, returning their slots to the storage if given
+    void makeEmpty(TraceTreeStorage* storage = nullptr);
+    /**
+     * Removes subtrees without leaves and returns their slots.
+     * @return True if the node is empty now.
+     */
+    bool prune(TraceTreeStorage& storage, CompiledTraceTree* compiled);
+    void makeTest(const CompactTLV& value, TraceTreeStorage& storage);
+    void makeLoad(const CompactTLV& value, TraceTreeStorage& storage);
+    void makePrefix(const PrefixSet& set, TraceTreeStorage& storage);
+    void makeRange(uint8_t field, uint16_t lo, uint16_t hi, TraceTreeStorage& storage);
+    void splitPriorities(TraceTreeNode* negative, TraceTreeNode* positive);
+    void makeLeaf(Flow* flow, of13::FlowMod* fm_base, TraceTreeStorage& storage,
+                  LeafIndex& index);
 
     struct TestData {
-        of13::OXMTLV*   value;
+        CompactTLV      value;
         TraceTreeNode*  positiveChild;
         TraceTreeNode*  negativeChild;
     };
 
+    // Branches of a Load node with large fan-out keyed by packed value
+    struct LoadIndex {
+        std::unordered_map<std::string, TraceTreeNode*> children;
+        // Masked values can't be found by the packet field value
+        bool masked;
+    };
+
     struct LoadData {
-        of13::OXMTLV*   value;
+        CompactTLV      value;
         TraceTreeNode*  child;
         LoadData*       next;
+        LoadIndex*      index; // used in the first element only
     };
 
+    // Kept out of the node, so lookups may use it after the node
+    // is reused, until the leaf is released by TraceTree::quiesce()
     struct LeafData {
         Flow* flow;
         of13::FlowMod* fm;
+        LeafIndex* index;
+        // Copies of the rule for paths going through ranges
+        std::vector<of13::Match>* matches;
+        // Packed flow-mods of the rule kept for reinstallations
+        std::vector<uint8_t>* packed;
+        // Neighbours in the list of installed leaves, ordered by
+        // the last installation or hit, for eviction
+        LeafData* older;
+        LeafData* newer;
+        // Packets counted by the switch since the installation
+        uint64_t packets;
+        // Flow table update sending the rules of the leaf
+        uint64_t batch;
+        // Cookie of the leaf installing the rule shared with this one,
+        // 0 when the leaf installs its own rule
+        uint64_t owner;
+    };
+
+    struct PrefixData {
+        PrefixSet*      set;
+        // [0] when nothing matches, [i + 1] for the i-th prefix
+        TraceTreeNode** children;
+    };
+
+    struct RangeData {
+        // Masked values covering the range, used for rules only
+        std::vector<CompactTLV>* values;
+        TraceTreeNode*  positiveChild;
+        TraceTreeNode*  negativeChild;
+        uint16_t        lo;
+        uint16_t        hi;
+        uint8_t         field;
     };
 
     union {
         TestData test;
         LoadData load;
-        LeafData leaf;
+        LeafData* leaf;
+        PrefixData prefix;
+        RangeData range;
     };
 
-    TraceTreeNode* move(TraceEntry& op);
+    void setPriorities(uint16_t lo, uint16_t hi);
+    void assignPriorities(unsigned lo, unsigned hi);
+    unsigned prioritiesNeeded();
+    uint16_t barrierPriority() const;
+    uint16_t barrierPriority(int prefix_index) const;
+    void layoutPrefix(unsigned lo, unsigned hi);
+    void assignSplit(TraceTreeNode* negative, TraceTreeNode* positive,
+                     unsigned lo, unsigned hi);
+
+    TraceTreeNode* move(TraceEntry& op, TraceTreeStorage& storage);
     LeafData* find(Packet* pkt);
-    Flow* find (uint64_t cookie);
     std::ostream& dump(std::ostream& out, size_t level);
 
     TraceTreeNode();
     ~TraceTreeNode();
 };
 
+// Maps cookies of installed rules to their leaves. Removed leaves
+// are kept here until lookups of other threads can't return them.
+struct LeafIndex {
+    std::unordered_map<uint64_t, TraceTreeNode*> cookies;
+    std::vector<TraceTreeNode::LeafData*> retired;
+    // Low half of the cookie given to the last leaf
+    uint32_t last;
+    // Ends of the recency list, eviction starts from the oldest leaf
+    TraceTreeNode::LeafData* oldest;
+    TraceTreeNode::LeafData* newest;
+
+    LeafIndex() : last(0), oldest(nullptr), newest(nullptr) { }
+
+    /// Makes the leaf the most recent one
+    void touch(TraceTreeNode::LeafData* leaf);
+    /// Takes the leaf out of the recency list, if it's there
+    void unlink(TraceTreeNode::LeafData* leaf);
+
+    /**
+     * Leaves are numbered in the low half of the cookie, zero is left
+     * for barriers. Numbers wrap around skipping cookies still in use.
+     */
+    uint64_t allocate(uint64_t base)
+    {
+        do {
+            if (++last == 0)
+                last = 1;
+        } while (cookies.count(base | last));
+        return base | last;
+    }
+};
+
+/**
+ * Nodes, Load branches and leaves of one tree are allocated from slabs.
+ * Pruned subtrees and released leaves give their slots back for new
+ * ones; the memory is released at once when the whole tree is cleared.
+ */
+struct TraceTreeStorage {
+    Slab<TraceTreeNode> nodes;
+    Slab<TraceTreeNode::LoadData> branches;
+    Slab<TraceTreeNode::LeafData> leaves;
+
+    TraceTreeNode* makeNode();
+    TraceTreeNode::LoadData* makeBranch();
+    TraceTreeNode::LeafData* makeLeaf();
+    /// Frees heap parts of the removed leaf and its slot
+    void releaseLeaf(TraceTreeNode::LeafData* leaf);
+    /// Destroys the node with its subtree and frees their slots
+    void destroyNode(TraceTreeNode* t);
+    void destroyBranch(TraceTreeNode::LoadData* l);
+    void clear();
+};
+
 class TraceTree : public QObject {
     Q_OBJECT
 public:
+    // Rules are installed into one of these tables; table 0 points to the active one
+    static const uint8_t firstTable = 1;
+    static const uint8_t secondTable = 2;
+    // Cookies of all rules installed by the tree
+    static const uint64_t cookieBase = 0x100000000UL;
+    static const uint64_t cookieMask = 0xffffffff00000000UL;
+
     TraceTree();
+    ~TraceTree();
+
+    /// Use flattened copy of the tree for packet lookups
+    void setCompiled(bool enable);
+
+    /**
+     * Merge permanent leaves with the same instructions into wildcarded
+     * rules and omit barriers fully covered by such rules.
+     * Applies to full builds only.
+     */
+    void setCompression(bool enable);
 
+    /**
+     * Allows to spread rules over several tables. Branches of Load nodes
+     * with equal subtrees are joined by metadata and installed into
+     * the next table once. Tables of the active and standby pipelines
+     * are interleaved, so each of them takes odd or even tables.
+     */
+    void setPipeline(unsigned stages);
+
+    //@{
+    /**
+     * Lookups run concurrently, everything changing the tree is
+     * serialized. Leaves removed by writers are released by quiesce(),
+     * so found leaves stay valid until the thread handling the switch
+     * calls it, even if their nodes are reused or pruned meanwhile.
+     */
     Flow* find(uint64_t cookie);
     TraceTreeNode::LeafData* find(Packet* pkt);
+    TraceTreeNode::LeafData* leaf(uint64_t cookie);
+    //@}
+
+    /// Releases removed leaves, no leaves found before may be used after it
+    void quiesce();
+
+    /**
+     * Copies fields tested or loaded anywhere in the tree, sorted.
+     * Caller keeps the vector to avoid reallocation on every lookup.
+     */
+    void fields(std::vector<uint8_t>& out) const;
+
+    /**
+     * Adds a new leaf to the tree and computes flow table changes
+     * required to install it. Existing rules are not touched.
+     */
     void augment(Flow* flow, of13::FlowMod* fm_base);
+
+    /**
+     * Sends rules accumulated by augment() since the last update.
+     * Falls back to the full rebuild when priority space was exhausted
+     * or a compressed subtree was changed.
+     * @return Number of rules sent.
+     */
+    unsigned updateFlowTable(OFConnection* ofconn);
+
+    /// Rules of the leaf are waiting for updateFlowTable()
+    bool pending(TraceTreeNode::LeafData* leaf) const;
+
+    /**
+     * Installs rules of the leaf removed from the switch. Rules are packed
+     * once and only the given fields are patched on later calls.
+     * Rules shared by several leaves are installed under the cookie of
+     * their owner. Returns the leaf whose rules were sent, or nullptr
+     * when the owner is gone and the tables will be rebuilt instead.
+     */
+    TraceTreeNode::LeafData* reinstall(TraceTreeNode::LeafData* leaf, OFConnection* ofconn,
+                                       uint32_t xid, uint32_t buffer_id);
+
+    /**
+     * Limits the number of rules in the active tables, 0 means unlimited.
+     * When the limit is reached, rules of the least recently hit leaves
+     * are removed from the switch. Such leaves stay in the tree and
+     * are reinstalled on the next table miss.
+     */
+    void setCapacity(unsigned rules);
+    unsigned capacity() const;
+
+    /// Number of rules supposed to be in the active tables
+    unsigned occupancy() const;
+    /// Corrects the occupancy with table stats reported by the switch
+    void setOccupancy(unsigned rules);
+
+    /// Table belongs to one of the pipelines
+    bool usesTable(uint8_t table) const;
+
+    /// Switch refused a rule because the table is full
+    void tableFull();
+    /// Switch removed a rule by timeout
+    void removed(uint64_t cookie);
+    /// Updates recency of the leaf from flow stats
+    void hit(uint64_t cookie, uint64_t packets);
+    /// Recency of installed leaves should be refreshed from flow stats
+    bool needsStats();
+
+    /**
+     * Requests the full rebuild, may be called from any thread. The next
+     * updateFlowTable() builds the whole tree into the standby table and
+     * redirects table 0 to it when the switch confirms the table is
+     * complete. Rules of the active table keep handling traffic until then.
+     */
+    void invalidateFlowTable();
+
+    /// updateFlowTable() has something to send
+    bool needsUpdate() const;
+
+    /// Table currently referenced by table 0
+    uint8_t table() const;
+
+    /**
+     * All flow-mods of the tree go to the switch through the pacer.
+     * Like everything sending to the switch, it is used only by
+     * the thread of the switch connection.
+     */
+    FlowModPacer& pacer() { return m_pacer; }
+
     void cleanFlowTable(OFConnection* ofconn);
     unsigned buildFlowTable(OFConnection* ofconn);
-    static bool isTableMiss(of13::PacketIn& pi);
+    static bool isTableMiss(const PacketInView& pi);
     std::ostream& dump(std::ostream& out);
     void clear();
 private:
+    friend struct BuildFTContext;
+
+    // Shared by lookups, exclusive for changes
+    mutable QReadWriteLock m_lock;
+
+    // Declared before the root, which destroys its children in place
+    TraceTreeStorage m_storage;
     TraceTreeNode root;
+    // Leaves added since the last update have this batch
+    uint64_t m_batch;
+    LeafIndex m_leaves;
+    std::vector<uint8_t> m_fields;
+    CompiledTraceTree* m_compiled;
+    uint8_t m_table;
+
+    // Packed flow-mods not yet sent to the switch
+    std::vector<uint8_t> m_pending;
+    unsigned m_pending_rules;
+    FlowModPacer m_pacer;
+    bool m_rebalance;
+    bool m_compress;
+    bool m_rebuild;
+    unsigned m_stages;
+    uint32_t m_groups;
+
+    unsigned m_capacity;
+    unsigned m_occupancy;
+    std::chrono::steady_clock::time_point m_stats_requested;
 
-    void buildFlowTableStep(struct BuildFTContext* ctx);
+    void rebalance();
+    unsigned rebuild(OFConnection* ofconn);
+    TraceTreeNode::LeafData* findLeaf(uint64_t cookie);
+    void makeRoom(OFConnection* ofconn, unsigned rules);
+    void cleanTables(OFConnection* ofconn, uint8_t table);
+    unsigned buildFlowTable(OFConnection* ofconn, uint8_t table);
 };
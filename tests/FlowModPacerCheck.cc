@@ -0,0 +1,204 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include "FlowModPacer.hh"
+
+#include <cstring>
+#include <fluid/util/util.h>
+
+#include "MessageTemplate.hh"
+#include "SendBuffer.hh"
+
+// Connection is never dereferenced, writes go to the recorder
+static char connection;
+static OFConnection* const conn = reinterpret_cast<OFConnection*>(&connection);
+
+/// Types and xids of messages written to switches by the calling thread
+class Sent {
+public:
+    struct Message {
+        uint8_t type;
+        uint32_t xid;
+    };
+
+    Sent()
+    {
+        setSendHook([this](OFConnection*, const void* data, size_t len) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            for (size_t offset = 0; offset < len; ) {
+                uint16_t length;
+                uint32_t xid;
+                memcpy(&length, bytes + offset + 2, sizeof(length));
+                memcpy(&xid, bytes + offset + MessageTemplate::xidOffset, sizeof(xid));
+                m_messages.push_back(Message{bytes[offset + 1], ntoh32(xid)});
+                offset += ntoh16(length);
+            }
+        });
+    }
+
+    ~Sent() { setSendHook(SendHook()); }
+
+    const std::vector<Message>& messages() const { return m_messages; }
+    void clear() { m_messages.clear(); }
+
+    unsigned count(uint8_t type) const
+    {
+        unsigned ret = 0;
+        for (auto& msg : m_messages)
+            ret += (msg.type == type);
+        return ret;
+    }
+
+    /// Xid of the last barrier sent
+    uint32_t lastBarrier() const
+    {
+        for (auto it = m_messages.rbegin(); it != m_messages.rend(); ++it) {
+            if (it->type == of13::OFPT_BARRIER_REQUEST)
+                return it->xid;
+        }
+        LOG(FATAL) << "No barriers sent";
+        return 0;
+    }
+
+private:
+    std::vector<Message> m_messages;
+};
+
+/// Packed batch of flow-mods
+static std::vector<uint8_t> batch(unsigned flowmods)
+{
+    std::vector<uint8_t> ret;
+    for (unsigned i = 0; i < flowmods; ++i) {
+        of13::FlowMod fm;
+        fm.command(of13::OFPFC_ADD);
+        fm.cookie(i + 1);
+        uint8_t* buf = fm.pack();
+        ret.insert(ret.end(), buf, buf + fm.length());
+        OFMsg::free_buffer(buf);
+    }
+    return ret;
+}
+
+static void send(FlowModPacer& pacer, unsigned flowmods)
+{
+    auto data = batch(flowmods);
+    pacer.send(conn, data.data(), data.size(), flowmods);
+}
+
+static void checkZeroWindow()
+{
+    Sent sent;
+    FlowModPacer pacer;
+
+    // Flow-mods are sent at once without barriers
+    send(pacer, 3);
+    CHECK_EQ(sent.count(of13::OFPT_FLOW_MOD), 3u);
+    CHECK_EQ(sent.count(of13::OFPT_BARRIER_REQUEST), 0u);
+    CHECK_EQ(pacer.inFlight(), 0u);
+
+    // Only explicit barriers are tracked
+    bool done = false;
+    pacer.barrier(conn, [&done](FlowModPacer::Clock::time_point) { done = true; });
+    CHECK_EQ(sent.count(of13::OFPT_BARRIER_REQUEST), 1u);
+    uint32_t xid = sent.lastBarrier();
+    // Xids of switches' own messages are never taken
+    CHECK_GE(xid, 0x80000000u);
+
+    CHECK(not pacer.barrierReply(conn, xid + 1));
+    CHECK(not done);
+    CHECK(pacer.barrierReply(conn, xid));
+    CHECK(done);
+    CHECK(not pacer.barrierReply(conn, xid));
+}
+
+static void checkWindow()
+{
+    Sent sent;
+    FlowModPacer pacer;
+    pacer.setWindow(4);
+
+    // Every batch is followed by a barrier
+    send(pacer, 2);
+    uint32_t first = sent.lastBarrier();
+    send(pacer, 2);
+    uint32_t second = sent.lastBarrier();
+    CHECK_EQ(sent.count(of13::OFPT_FLOW_MOD), 4u);
+    CHECK_EQ(sent.count(of13::OFPT_BARRIER_REQUEST), 2u);
+    CHECK_EQ(pacer.inFlight(), 4u);
+
+    // Batches beyond the window wait for confirmations
+    send(pacer, 1);
+    bool done = false;
+    pacer.barrier(conn, [&done](FlowModPacer::Clock::time_point) { done = true; });
+    CHECK_EQ(pacer.queued(), 1u);
+    CHECK_EQ(sent.count(of13::OFPT_FLOW_MOD), 4u);
+    CHECK_EQ(sent.count(of13::OFPT_BARRIER_REQUEST), 2u);
+
+    CHECK(pacer.barrierReply(conn, first));
+    CHECK_EQ(pacer.queued(), 0u);
+    CHECK_EQ(sent.count(of13::OFPT_FLOW_MOD), 5u);
+    CHECK_EQ(pacer.inFlight(), 3u);
+    CHECK(not done);
+
+    // Reply to a later barrier confirms the earlier ones too
+    uint32_t third = sent.lastBarrier();
+    CHECK(pacer.barrierReply(conn, third));
+    CHECK_EQ(pacer.inFlight(), 0u);
+    CHECK(done);
+    CHECK(not pacer.barrierReply(conn, second));
+
+    // Barrier with nothing unconfirmed completes at once
+    done = false;
+    pacer.barrier(conn, [&done](FlowModPacer::Clock::time_point) { done = true; });
+    CHECK(done);
+}
+
+static void checkLargeBatch()
+{
+    Sent sent;
+    FlowModPacer pacer;
+    pacer.setWindow(2);
+
+    // Batch larger than the window isn't stuck, it's sent alone
+    send(pacer, 5);
+    CHECK_EQ(sent.count(of13::OFPT_FLOW_MOD), 5u);
+    send(pacer, 1);
+    CHECK_EQ(pacer.queued(), 1u);
+
+    CHECK(pacer.barrierReply(conn, sent.lastBarrier()));
+    CHECK_EQ(sent.count(of13::OFPT_FLOW_MOD), 6u);
+    CHECK_EQ(pacer.inFlight(), 1u);
+
+    // Closed connection leaves nothing behind
+    send(pacer, 2);
+    CHECK_EQ(pacer.queued(), 1u);
+    pacer.reset();
+    CHECK_EQ(pacer.queued(), 0u);
+    CHECK_EQ(pacer.inFlight(), 0u);
+    CHECK(not pacer.barrierReply(conn, sent.lastBarrier()));
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    checkZeroWindow();
+    checkWindow();
+    checkLargeBatch();
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include "Match.hh"
+
+static IPAddress ip(const char* str)
+{
+    return IPAddress(std::string(str));
+}
+
+static void checkExactMatch()
+{
+    of13::IPv4Dst rule(ip("10.0.0.1"));
+    of13::IPv4Dst same(ip("10.0.0.1"));
+    of13::IPv4Dst other(ip("10.0.0.2"));
+
+    CHECK(oxm_match(rule, ip("10.0.0.1")));
+    CHECK(not oxm_match(rule, ip("10.0.0.2")));
+    CHECK(oxm_match(&rule, &same));
+    CHECK(not oxm_match(&rule, &other));
+}
+
+static void checkMaskedMatch()
+{
+    of13::IPv4Dst rule(ip("10.0.0.0"), ip("255.255.255.0"));
+
+    // Host bits of the packet are ignored
+    CHECK(oxm_match(rule, ip("10.0.0.0")));
+    CHECK(oxm_match(rule, ip("10.0.0.7")));
+    CHECK(not oxm_match(rule, ip("10.0.1.7")));
+
+    of13::IPv4Dst inside(ip("10.0.0.200"));
+    of13::IPv4Dst outside(ip("10.1.0.200"));
+    CHECK(oxm_match(&rule, &inside));
+    CHECK(not oxm_match(&rule, &outside));
+
+    // And so are the bits of the rule value outside of the mask
+    of13::IPv4Dst dirty(ip("10.0.0.5"), ip("255.255.255.0"));
+    CHECK(oxm_match(dirty, ip("10.0.0.9")));
+    CHECK(not oxm_match(dirty, ip("10.0.1.5")));
+
+    of13::EthDst multicast(EthAddress("01:00:00:00:00:00"), EthAddress("01:00:00:00:00:00"));
+    CHECK(oxm_match(multicast, EthAddress("33:33:00:00:00:01")));
+    CHECK(not oxm_match(multicast, EthAddress("00:11:22:33:44:55")));
+}
+
+static void checkBitwiseAnd()
+{
+    IPAddress net = ip("192.168.17.5") & ip("255.255.240.0");
+    CHECK_EQ(net.getIPv4(), ip("192.168.16.0").getIPv4());
+
+    EthAddress oui = EthAddress("00:11:22:33:44:55") & EthAddress("ff:ff:ff:00:00:00");
+    CHECK_EQ(oui.to_string(), "00:11:22:00:00:00");
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    checkExactMatch();
+    checkMaskedMatch();
+    checkBitwiseAnd();
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "MessageTemplate.hh"
+
+#include <cstring>
+#include <fluid/util/util.h>
+
+#include "SendBuffer.hh"
+
+static uint16_t get16(const uint8_t* msg, size_t offset)
+{
+    uint16_t ret;
+    memcpy(&ret, msg + offset, sizeof(ret));
+    return ntoh16(ret);
+}
+
+static uint32_t get32(const uint8_t* msg, size_t offset)
+{
+    uint32_t ret;
+    memcpy(&ret, msg + offset, sizeof(ret));
+    return ntoh32(ret);
+}
+
+static uint64_t get64(const uint8_t* msg, size_t offset)
+{
+    uint64_t ret;
+    memcpy(&ret, msg + offset, sizeof(ret));
+    return ntoh64(ret);
+}
+
+static void fillFlowMod(of13::FlowMod& fm)
+{
+    fm.xid(0x1234);
+    fm.cookie(0x1122334455667788ULL);
+    fm.table_id(5);
+    fm.command(of13::OFPFC_ADD);
+    // Neighbours of the patched fields must stay intact
+    fm.idle_timeout(11);
+    fm.hard_timeout(30);
+    fm.priority(1000);
+    fm.buffer_id(0x55);
+    fm.out_port(9);
+    fm.out_group(of13::OFPG_ANY);
+    fm.add_oxm_field(new of13::InPort(3));
+}
+
+static void checkFlowModOffsets()
+{
+    of13::FlowMod fm;
+    fillFlowMod(fm);
+    MessageTemplate tpl(fm);
+    const uint8_t* msg = tpl.data();
+
+    CHECK_EQ(tpl.length(), size_t(fm.length()));
+    CHECK_EQ(get32(msg, MessageTemplate::xidOffset), 0x1234u);
+    CHECK_EQ(get64(msg, MessageTemplate::flowModCookie), 0x1122334455667788ULL);
+    CHECK_EQ(msg[MessageTemplate::flowModTableId], 5);
+    CHECK_EQ(get16(msg, MessageTemplate::flowModHardTimeout), 30);
+    CHECK_EQ(get32(msg, MessageTemplate::flowModBufferId), 0x55u);
+    CHECK_EQ(get32(msg, MessageTemplate::flowModOutPort), 9u);
+}
+
+static void checkFlowModPatch()
+{
+    of13::FlowMod fm;
+    fillFlowMod(fm);
+    MessageTemplate tpl(fm);
+
+    SendBuffer buf;
+    uint8_t* msg = tpl.copyTo(buf);
+    MessageTemplate::setXid(msg, 0x99);
+    MessageTemplate::set64(msg, MessageTemplate::flowModCookie, 0xabcdefULL);
+    MessageTemplate::set8(msg, MessageTemplate::flowModTableId, 7);
+    MessageTemplate::set16(msg, MessageTemplate::flowModHardTimeout, 120);
+    MessageTemplate::set32(msg, MessageTemplate::flowModBufferId, 0x77);
+    MessageTemplate::set32(msg, MessageTemplate::flowModOutPort, of13::OFPP_ANY);
+
+    of13::FlowMod patched;
+    CHECK_EQ(patched.unpack(msg), 0);
+    CHECK_EQ(patched.xid(), 0x99u);
+    CHECK_EQ(patched.cookie(), 0xabcdefULL);
+    CHECK_EQ(patched.table_id(), 7);
+    CHECK_EQ(patched.hard_timeout(), 120);
+    CHECK_EQ(patched.buffer_id(), 0x77u);
+    CHECK_EQ(patched.out_port(), uint32_t(of13::OFPP_ANY));
+    CHECK_EQ(patched.idle_timeout(), 11);
+    CHECK_EQ(patched.priority(), 1000);
+    CHECK_EQ(patched.command(), of13::OFPFC_ADD);
+
+    // Template itself isn't changed by patching the copy
+    CHECK_EQ(get32(tpl.data(), MessageTemplate::xidOffset), 0x1234u);
+    CHECK_EQ(get16(tpl.data(), MessageTemplate::flowModHardTimeout), 30);
+}
+
+static void checkPacketOutOffsets()
+{
+    of13::PacketOut po(0x42, OFP_NO_BUFFER, 1);
+    po.add_action(new of13::OutputAction(7, 0));
+    MessageTemplate tpl(po);
+
+    size_t action = MessageTemplate::packetOutActions;
+    CHECK_EQ(get16(tpl.data(), action), of13::OFPAT_OUTPUT);
+    CHECK_EQ(get32(tpl.data(), action + MessageTemplate::outputActionPort), 7u);
+}
+
+static void checkPacketOutAppend()
+{
+    uint8_t data[60];
+    for (size_t i = 0; i < sizeof(data); ++i)
+        data[i] = uint8_t(i);
+
+    ActionList actions;
+    actions.add_action(new of13::OutputAction(of13::OFPP_FLOOD, 0));
+
+    of13::PacketOut po(0x42, OFP_NO_BUFFER, 3);
+    po.actions(actions);
+    po.data(data, sizeof(data));
+    MessageTemplate expected(po);
+
+    SendBuffer buf;
+    buf.appendPacketOut(0x42, OFP_NO_BUFFER, 3, actions, data, sizeof(data));
+    CHECK_EQ(buf.size(), expected.length());
+    CHECK_EQ(memcmp(buf.data(), expected.data(), buf.size()), 0);
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    checkFlowModOffsets();
+    checkFlowModPatch();
+    checkPacketOutOffsets();
+    checkPacketOutAppend();
+    return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Packet.hh"
+
+#include <cstring>
+
+#include "Arena.hh"
+#include "PacketInView.hh"
+
+/// Bytes of a frame in network byte order
+class Frame {
+public:
+    Frame& u8(uint8_t v) { m_data.push_back(v); return *this; }
+    Frame& u16(uint16_t v) { return u8(v >> 8).u8(v & 0xff); }
+    Frame& u32(uint32_t v) { return u16(v >> 16).u16(v & 0xffff); }
+    Frame& zero(size_t n) { m_data.insert(m_data.end(), n, 0); return *this; }
+    Frame& bytes(const uint8_t* p, size_t n) { m_data.insert(m_data.end(), p, p + n); return *this; }
+
+    Frame& eth(uint16_t type)
+    {
+        static const uint8_t dst[6] = {0, 0, 0, 0, 0, 2};
+        static const uint8_t src[6] = {0, 0, 0, 0, 0, 1};
+        return bytes(dst, 6).bytes(src, 6).u16(type);
+    }
+
+    const std::vector<uint8_t>& data() const { return m_data; }
+
+private:
+    std::vector<uint8_t> m_data;
+};
+
+static const uint8_t ipv6Src[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+static const uint8_t ipv6Dst[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2};
+
+/// Packet-in with the in_port match and the frame as data
+static std::vector<uint8_t> packetIn(const Frame& frame, uint32_t in_port)
+{
+    Frame msg;
+    size_t length = 42 + frame.data().size();
+    msg.u8(of13::OFP_VERSION).u8(of13::OFPT_PACKET_IN).u16(length).u32(1)
+       .u32(OFP_NO_BUFFER).u16(frame.data().size()).u8(of13::OFPR_NO_MATCH).u8(0)
+       .u32(0).u32(0)
+       // OXM match with in_port padded to 8 bytes, then 2 bytes of padding
+       .u16(1).u16(12).u32(0x80000004).u32(in_port).zero(4)
+       .zero(2)
+       .bytes(frame.data().data(), frame.data().size());
+    return msg.data();
+}
+
+/// Packet reading the frame, valid while the check runs
+class Parsed {
+public:
+    Parsed(const Frame& frame, uint32_t in_port = 7)
+        : m_msg(packetIn(frame, in_port))
+    {
+        CHECK(m_view.parse(m_msg.data(), m_msg.size()));
+        m_pkt = m_arena.make<Packet>(m_view, m_arena);
+    }
+
+    Packet* operator->() { return m_pkt; }
+
+private:
+    std::vector<uint8_t> m_msg;
+    PacketInView m_view;
+    Arena m_arena;
+    Packet* m_pkt;
+};
+
+static uint32_t ipv4(const char* str)
+{
+    return IPAddress(std::string(str)).getIPv4();
+}
+
+static bool sameIPv6(IPAddress addr, const uint8_t* expected)
+{
+    return memcmp(addr.getIPv6(), expected, 16) == 0;
+}
+
+static void checkVLANIPv4TCP()
+{
+    Frame frame;
+    frame.eth(0x8100).u16((5 << 13) | 100).u16(0x0800)
+         // IPv4: DSCP 46, ECN 1, don't fragment, TCP
+         .u8(0x45).u8(0xb9).u16(40).u16(0).u16(0x4000).u8(64).u8(6).u16(0)
+         .u32(0x0a000001).u32(0x0a000002)
+         .u16(1234).u16(80).zero(16);
+
+    Parsed pkt(frame);
+    CHECK_EQ(pkt->readInPort(), 7u);
+    CHECK(pkt->readEthSrc() == EthAddress("00:00:00:00:00:01"));
+    CHECK(pkt->readEthDst() == EthAddress("00:00:00:00:00:02"));
+    CHECK_EQ(pkt->readEthType(), 0x0800);
+    CHECK_EQ(pkt->readVLANVid(), of13::OFPVID_PRESENT | 100);
+    CHECK_EQ(pkt->readVLANPcp(), 5);
+    CHECK_EQ(pkt->readIPProto(), 6);
+    CHECK_EQ(pkt->readIPv4Src().getIPv4(), ipv4("10.0.0.1"));
+    CHECK_EQ(pkt->readIPv4Dst().getIPv4(), ipv4("10.0.0.2"));
+    CHECK_EQ(pkt->readIPDSCP(), 46);
+    CHECK_EQ(pkt->readIPECN(), 1);
+    CHECK_EQ(pkt->readTCPSrc(), 1234);
+    CHECK_EQ(pkt->readTCPDst(), 80);
+    CHECK_EQ(pkt->readUDPSrc(), 0);
+}
+
+static void checkIPv4Options()
+{
+    Frame first;
+    first.eth(0x0800)
+         // Header with one word of options, UDP
+         .u8(0x46).u8(0).u16(32).u16(0).u16(0x2000).u8(64).u8(17).u16(0)
+         .u32(0x0a000001).u32(0x0a000002).u32(0x01010101)
+         .u16(53).u16(5353).u16(8).u16(0);
+
+    Parsed pkt(first);
+    CHECK_EQ(pkt->readUDPSrc(), 53);
+    CHECK_EQ(pkt->readUDPDst(), 5353);
+
+    // Only the first fragment has the transport header
+    Frame next;
+    next.eth(0x0800)
+        .u8(0x45).u8(0).u16(28).u16(0).u16(0x0001).u8(64).u8(17).u16(0)
+        .u32(0x0a000001).u32(0x0a000002)
+        .u16(53).u16(5353).u16(8).u16(0);
+
+    Parsed fragment(next);
+    CHECK_EQ(fragment->readIPProto(), 17);
+    CHECK_EQ(fragment->readUDPSrc(), 0);
+    CHECK_EQ(fragment->readUDPDst(), 0);
+}
+
+static void checkTruncated()
+{
+    Frame frame;
+    frame.eth(0x0800).u8(0x45).u8(0).u16(40).zero(6);
+
+    Parsed pkt(frame);
+    CHECK_EQ(pkt->readEthType(), 0x0800);
+    CHECK_EQ(pkt->readIPv4Src().getIPv4(), 0u);
+    CHECK_EQ(pkt->readIPProto(), 0);
+    CHECK_EQ(pkt->readTCPDst(), 0);
+}
+
+static void checkIPv6ExtensionHeaders()
+{
+    Frame frame;
+    frame.eth(0x86dd)
+         // Traffic class 0xb9, flow label 0x12345, hop-by-hop options
+         .u32(0x60000000 | (0xb9 << 20) | 0x12345).u16(16).u8(0).u8(64)
+         .bytes(ipv6Src, 16).bytes(ipv6Dst, 16)
+         .u8(17).u8(0).zero(6)
+         .u16(53).u16(5353).u16(8).u16(0);
+
+    Parsed pkt(frame);
+    CHECK_EQ(pkt->readEthType(), 0x86dd);
+    CHECK_EQ(pkt->readIPProto(), 17);
+    CHECK_EQ(pkt->readIPv6Flabel(), 0x12345u);
+    CHECK_EQ(pkt->readIPDSCP(), 46);
+    CHECK_EQ(pkt->readIPECN(), 1);
+    CHECK(sameIPv6(pkt->readIPv6Src(), ipv6Src));
+    CHECK(sameIPv6(pkt->readIPv6Dst(), ipv6Dst));
+    CHECK_EQ(pkt->readUDPSrc(), 53);
+    CHECK_EQ(pkt->readUDPDst(), 5353);
+    CHECK_EQ(pkt->readIPv4Src().getIPv4(), 0u);
+}
+
+static void checkNeighborSolicitation()
+{
+    static const uint8_t mac[6] = {0, 0, 0, 0, 0, 1};
+
+    Frame frame;
+    frame.eth(0x86dd)
+         .u32(0x60000000).u16(32).u8(58).u8(255)
+         .bytes(ipv6Src, 16).bytes(ipv6Dst, 16)
+         // ICMPv6 solicitation with source link-layer address option
+         .u8(135).u8(0).u16(0).u32(0).bytes(ipv6Dst, 16)
+         .u8(1).u8(1).bytes(mac, 6);
+
+    Parsed pkt(frame);
+    CHECK_EQ(pkt->readICMPv6Type(), 135);
+    CHECK_EQ(pkt->readICMPv6Code(), 0);
+    CHECK(sameIPv6(pkt->readIPv6NDTarget(), ipv6Dst));
+    CHECK(pkt->readIPv6NDSLL() == EthAddress("00:00:00:00:00:01"));
+    CHECK(pkt->readIPv6NDTLL() == EthAddress());
+}
+
+static void checkARP()
+{
+    static const uint8_t mac[6] = {0, 0, 0, 0, 0, 1};
+
+    Frame frame;
+    frame.eth(0x0806)
+         .u16(1).u16(0x0800).u8(6).u8(4).u16(1)
+         .bytes(mac, 6).u32(0x0a000001)
+         .zero(6).u32(0x0a000002);
+
+    Parsed pkt(frame);
+    CHECK_EQ(pkt->readARPOp(), 1);
+    CHECK(pkt->readARPSHA() == EthAddress("00:00:00:00:00:01"));
+    CHECK_EQ(pkt->readARPSPA().getIPv4(), ipv4("10.0.0.1"));
+    CHECK_EQ(pkt->readARPTPA().getIPv4(), ipv4("10.0.0.2"));
+    CHECK_EQ(pkt->readIPProto(), 0);
+}
+
+static void checkMPLS()
+{
+    Frame frame;
+    frame.eth(0x8847).u32((0x12345 << 12) | (5 << 9) | (1 << 8) | 64).zero(20);
+
+    Parsed pkt(frame);
+    CHECK_EQ(pkt->readMPLSLabel(), 0x12345u);
+    CHECK_EQ(pkt->readMPLSTC(), 5);
+    CHECK_EQ(pkt->readMPLSBOS(), 1);
+    CHECK_EQ(pkt->readIPProto(), 0);
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    checkVLANIPv4TCP();
+    checkIPv4Options();
+    checkTruncated();
+    checkIPv6ExtensionHeaders();
+    checkNeighborSolicitation();
+    checkARP();
+    checkMPLS();
+    return 0;
+}
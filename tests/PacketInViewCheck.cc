@@ -0,0 +1,128 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "PacketInView.hh"
+
+#include <cstring>
+#include <fluid/util/util.h>
+
+/// Packet-in packed by libfluid, the reference for the view
+static std::vector<uint8_t> pack(of13::PacketIn& pi)
+{
+    uint8_t* buf = pi.pack();
+    std::vector<uint8_t> ret(buf, buf + pi.length());
+    OFMsg::free_buffer(buf);
+    return ret;
+}
+
+static std::vector<uint8_t> payload(size_t len)
+{
+    std::vector<uint8_t> ret(len);
+    for (size_t i = 0; i < len; ++i)
+        ret[i] = uint8_t(i * 7 + 1);
+    return ret;
+}
+
+static void checkFields()
+{
+    std::vector<uint8_t> data = payload(60);
+
+    of13::PacketIn pi(0x12345678, 0x100, data.size(), of13::OFPR_ACTION, 3,
+                      0x1122334455667788ULL);
+    pi.add_oxm_field(new of13::InPort(5));
+    pi.add_oxm_field(new of13::InPhyPort(6));
+    pi.add_oxm_field(new of13::EthType(0x0800));
+    pi.add_oxm_field(new of13::Metadata(0xdeadbeef00ULL));
+    pi.data(data.data(), data.size());
+    std::vector<uint8_t> msg = pack(pi);
+
+    PacketInView view;
+    CHECK(view.parse(msg.data(), msg.size()));
+    CHECK_EQ(view.xid(), 0x12345678u);
+    CHECK_EQ(view.buffer_id(), 0x100u);
+    CHECK_EQ(size_t(view.total_len()), data.size());
+    CHECK_EQ(view.reason(), of13::OFPR_ACTION);
+    CHECK_EQ(view.table_id(), 3);
+    CHECK_EQ(view.cookie(), 0x1122334455667788ULL);
+    CHECK_EQ(view.in_port(), 5u);
+    CHECK_EQ(view.in_phy_port(), 6u);
+    CHECK_EQ(view.metadata(), 0xdeadbeef00ULL);
+    CHECK_EQ(view.data_len(), data.size());
+    CHECK_EQ(memcmp(view.data(), data.data(), data.size()), 0);
+    // Data points into the message
+    CHECK(view.data() > msg.data() && view.data() < msg.data() + msg.size());
+}
+
+static void checkEmptyMatch()
+{
+    std::vector<uint8_t> data = payload(14);
+
+    of13::PacketIn pi(1, OFP_NO_BUFFER, data.size(), of13::OFPR_NO_MATCH, 0, 0);
+    pi.data(data.data(), data.size());
+    std::vector<uint8_t> msg = pack(pi);
+
+    PacketInView view;
+    CHECK(view.parse(msg.data(), msg.size()));
+    CHECK_EQ(view.buffer_id(), uint32_t(OFP_NO_BUFFER));
+    CHECK_EQ(view.in_port(), uint32_t(of13::OFPP_ANY));
+    CHECK_EQ(view.in_phy_port(), uint32_t(of13::OFPP_ANY));
+    CHECK_EQ(view.metadata(), 0u);
+    CHECK_EQ(view.data_len(), data.size());
+    CHECK_EQ(memcmp(view.data(), data.data(), data.size()), 0);
+}
+
+static void checkMalformed()
+{
+    std::vector<uint8_t> data = payload(20);
+
+    of13::PacketIn pi(1, OFP_NO_BUFFER, data.size(), of13::OFPR_NO_MATCH, 0, 0);
+    pi.add_oxm_field(new of13::InPort(1));
+    pi.data(data.data(), data.size());
+    std::vector<uint8_t> msg = pack(pi);
+    PacketInView view;
+
+    // Message is longer than the buffer
+    CHECK(not view.parse(msg.data(), msg.size() - 1));
+    CHECK(not view.parse(msg.data(), 20));
+
+    // Match is shorter than its header
+    std::vector<uint8_t> bad = msg;
+    uint16_t match_len = hton16(2);
+    memcpy(&bad[26], &match_len, 2);
+    CHECK(not view.parse(bad.data(), bad.size()));
+
+    // Match runs past the end of the message
+    bad = msg;
+    match_len = hton16(bad.size());
+    memcpy(&bad[26], &match_len, 2);
+    CHECK(not view.parse(bad.data(), bad.size()));
+
+    // OXM value runs past the end of the match
+    bad = msg;
+    bad[31] = 12;
+    CHECK(not view.parse(bad.data(), bad.size()));
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    checkFields();
+    checkEmptyMatch();
+    checkMalformed();
+    return 0;
+}
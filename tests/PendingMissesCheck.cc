@@ -0,0 +1,183 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "PendingMisses.hh"
+
+#include <string>
+
+struct Released {
+    uint64_t cookie;
+    uint32_t xid;
+    std::string payload;
+};
+
+static std::string payload(char c, size_t len)
+{
+    return std::string(len, c);
+}
+
+static void park(PendingMisses& pending, uint64_t cookie, uint32_t xid, const std::string& data)
+{
+    pending.park(cookie, xid, OFP_NO_BUFFER, 1,
+                 reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+static std::vector<Released> release(PendingMisses& pending)
+{
+    std::vector<Released> ret;
+    pending.release([&](const PendingMisses::Parked& p) {
+        ret.push_back(Released{ p.cookie, p.xid,
+            p.data ? std::string(reinterpret_cast<const char*>(p.data), p.data_len)
+                   : std::string() });
+    });
+    return ret;
+}
+
+static void checkDisabled()
+{
+    PendingMisses pending;
+    CHECK(not pending.enabled());
+    pending.install(1);
+    CHECK(not pending.installing(1));
+    CHECK(not pending.seal());
+}
+
+static void checkGroups()
+{
+    PendingMisses pending;
+    pending.resize(256);
+
+    pending.install(1);
+    pending.install(2);
+    CHECK(pending.installing(1));
+    CHECK(pending.seal());
+    CHECK(not pending.seal());
+    pending.install(3);
+    CHECK(pending.seal());
+
+    park(pending, 3, 30, payload('c', 10));
+    park(pending, 1, 10, payload('a', 10));
+    park(pending, 2, 20, payload('b', 20));
+    // Buffered packet has no payload
+    pending.park(1, 11, 0x100, 1, nullptr, 0);
+
+    // Groups are confirmed in the order they were sealed
+    std::vector<Released> first = release(pending);
+    CHECK_EQ(first.size(), 3u);
+    CHECK_EQ(first[0].xid, 10u);
+    CHECK_EQ(first[0].payload, payload('a', 10));
+    CHECK_EQ(first[1].xid, 20u);
+    CHECK_EQ(first[1].payload, payload('b', 20));
+    CHECK_EQ(first[2].xid, 11u);
+    CHECK(first[2].payload.empty());
+    CHECK(not pending.installing(1));
+    CHECK(pending.installing(3));
+
+    std::vector<Released> second = release(pending);
+    CHECK_EQ(second.size(), 1u);
+    CHECK_EQ(second[0].cookie, 3u);
+    CHECK_EQ(second[0].payload, payload('c', 10));
+
+    CHECK(release(pending).empty());
+    CHECK_EQ(pending.dropped(), 0u);
+}
+
+static void checkWrap()
+{
+    PendingMisses pending;
+    pending.resize(64);
+
+    pending.install(1);
+    pending.seal();
+    pending.install(2);
+    pending.seal();
+
+    park(pending, 1, 1, payload('a', 30));
+    park(pending, 2, 2, payload('b', 30));
+    CHECK_EQ(release(pending).size(), 1u);
+
+    // Doesn't fit after 'b', goes to the freed start of the ring
+    park(pending, 2, 3, payload('c', 20));
+    // Fits between 'c' and 'b'
+    park(pending, 2, 4, payload('d', 10));
+
+    std::vector<Released> released = release(pending);
+    CHECK_EQ(released.size(), 3u);
+    CHECK_EQ(released[0].payload, payload('b', 30));
+    CHECK_EQ(released[1].payload, payload('c', 20));
+    CHECK_EQ(released[2].payload, payload('d', 10));
+    CHECK_EQ(pending.dropped(), 0u);
+}
+
+static void checkEviction()
+{
+    PendingMisses pending;
+    pending.resize(64);
+
+    pending.install(1);
+    pending.seal();
+
+    park(pending, 1, 1, payload('a', 30));
+    park(pending, 1, 2, payload('b', 30));
+    // Ring is full, the oldest packet is dropped
+    park(pending, 1, 3, payload('c', 30));
+    CHECK_EQ(pending.dropped(), 1u);
+    // Larger than the whole ring
+    park(pending, 1, 4, payload('d', 65));
+    CHECK_EQ(pending.dropped(), 2u);
+
+    std::vector<Released> released = release(pending);
+    CHECK_EQ(released.size(), 2u);
+    CHECK_EQ(released[0].xid, 2u);
+    CHECK_EQ(released[0].payload, payload('b', 30));
+    CHECK_EQ(released[1].xid, 3u);
+    CHECK_EQ(released[1].payload, payload('c', 30));
+}
+
+static void checkClear()
+{
+    PendingMisses pending;
+    pending.resize(64);
+
+    pending.install(1);
+    pending.seal();
+    park(pending, 1, 1, payload('a', 30));
+    pending.clear();
+
+    CHECK(not pending.installing(1));
+    CHECK(release(pending).empty());
+
+    // Ring starts from the beginning again
+    pending.install(2);
+    pending.seal();
+    park(pending, 2, 2, payload('b', 64));
+    std::vector<Released> released = release(pending);
+    CHECK_EQ(released.size(), 1u);
+    CHECK_EQ(released[0].payload, payload('b', 64));
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    checkDisabled();
+    checkGroups();
+    checkWrap();
+    checkEviction();
+    checkClear();
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "PortRange.hh"
+
+#include <memory>
+
+typedef std::vector<std::unique_ptr<of13::OXMTLV>> Blocks;
+
+static Blocks expand(uint16_t lo, uint16_t hi)
+{
+    Blocks ret;
+    for (of13::OXMTLV* tlv : expandPortRange(of13::OFPXMT_OFB_TCP_DST, lo, hi))
+        ret.emplace_back(tlv);
+    return ret;
+}
+
+static const MaskedPort* block(const Blocks& blocks, size_t i)
+{
+    return static_cast<const MaskedPort*>(blocks.at(i).get());
+}
+
+// Every port of the range is matched by exactly one block, others by none
+static void checkCover(uint16_t lo, uint16_t hi)
+{
+    Blocks blocks = expand(lo, hi);
+    for (uint32_t port = 0; port <= 0xffff; ++port) {
+        int matched = 0;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            const MaskedPort* b = block(blocks, i);
+            if ((port & b->mask()) == b->value())
+                ++matched;
+        }
+        CHECK_EQ(matched, (port >= lo && port <= hi) ? 1 : 0)
+            << "port " << port << " of range [" << lo << ", " << hi << "]";
+    }
+}
+
+static void checkKnownRanges()
+{
+    Blocks full = expand(0, 0xffff);
+    CHECK_EQ(full.size(), 1u);
+    CHECK_EQ(block(full, 0)->mask(), 0);
+
+    Blocks single = expand(80, 80);
+    CHECK_EQ(single.size(), 1u);
+    CHECK_EQ(block(single, 0)->value(), 80);
+    CHECK_EQ(block(single, 0)->mask(), 0xffff);
+
+    Blocks wellKnown = expand(0, 1023);
+    CHECK_EQ(wellKnown.size(), 1u);
+    CHECK_EQ(block(wellKnown, 0)->mask(), 0xfc00);
+
+    // 1024, 2048, ..., 32768 sized blocks
+    CHECK_EQ(expand(1024, 0xffff).size(), 6u);
+    // Worst case for 16 bits
+    CHECK_EQ(expand(1, 0xfffe).size(), 30u);
+}
+
+static void checkPack()
+{
+    MaskedPort port(of13::OFPXMT_OFB_UDP_SRC, 0x1234, 0xff00);
+    CHECK_EQ(port.value(), 0x1200);
+
+    uint8_t buf[8];
+    port.pack(buf);
+    CHECK_EQ(buf[0], 0x80);
+    CHECK_EQ(buf[1], 0x00);
+    CHECK_EQ(buf[2], (of13::OFPXMT_OFB_UDP_SRC << 1) | 1);
+    CHECK_EQ(buf[3], 4);
+    CHECK_EQ(buf[4], 0x12);
+    CHECK_EQ(buf[5], 0x00);
+    CHECK_EQ(buf[6], 0xff);
+    CHECK_EQ(buf[7], 0x00);
+
+    MaskedPort copy(of13::OFPXMT_OFB_UDP_SRC, 0, 0);
+    copy.unpack(buf);
+    CHECK(copy.equals(port));
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    checkKnownRanges();
+    checkCover(0, 0xffff);
+    checkCover(1, 0xfffe);
+    checkCover(1000, 1999);
+    checkCover(5000, 5000);
+    checkCover(49152, 65535);
+    checkPack();
+    return 0;
+}
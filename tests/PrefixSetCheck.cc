@@ -0,0 +1,98 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "PrefixSet.hh"
+
+static uint32_t addr(const char* str)
+{
+    return IPAddress(std::string(str)).getIPv4();
+}
+
+static void checkLongestMatch()
+{
+    PrefixSet set(of13::OFPXMT_OFB_IPV4_DST);
+    int net8 = set.add("10.0.0.0/8");
+    int net16 = set.add("10.1.0.0/16");
+    int net24 = set.add("10.1.2.0/24");
+    int host = set.add("10.1.2.3");
+
+    CHECK_EQ(set.size(), 4u);
+    CHECK_EQ(set.lookup(addr("10.1.2.3")), host);
+    CHECK_EQ(set.lookup(addr("10.1.2.4")), net24);
+    CHECK_EQ(set.lookup(addr("10.1.3.4")), net16);
+    CHECK_EQ(set.lookup(addr("10.2.0.1")), net8);
+    CHECK_EQ(set.lookup(addr("11.0.0.1")), -1);
+
+    of13::IPv4Dst value(IPAddress(std::string("10.1.200.1")));
+    CHECK_EQ(set.lookup(&value), net16);
+}
+
+static void checkDefaultRoute()
+{
+    PrefixSet set(of13::OFPXMT_OFB_IPV4_SRC);
+    int any = set.add("0.0.0.0/0");
+    int net = set.add("192.168.0.0/16");
+
+    CHECK_EQ(set.lookup(addr("8.8.8.8")), any);
+    CHECK_EQ(set.lookup(addr("192.168.1.1")), net);
+    CHECK_EQ(set.length(any), 0);
+}
+
+static void checkDuplicates()
+{
+    PrefixSet set(of13::OFPXMT_OFB_IPV4_DST);
+    int net = set.add("172.16.0.0/12");
+
+    // Host bits are ignored, so both are the same prefix
+    CHECK_EQ(set.add("172.17.1.1/12"), net);
+    CHECK_EQ(set.add(IPAddress(std::string("172.16.0.0")), 12), net);
+    CHECK_EQ(set.size(), 1u);
+
+    of13::IPv4Dst* tlv = static_cast<of13::IPv4Dst*>(set.tlv(net));
+    CHECK(tlv->has_mask());
+    CHECK(tlv->value() == IPAddress(std::string("172.16.0.0")));
+    CHECK(tlv->mask() == IPAddress(std::string("255.240.0.0")));
+}
+
+static void checkCopy()
+{
+    PrefixSet set(of13::OFPXMT_OFB_IPV4_DST);
+    set.add("10.0.0.0/8");
+    set.add("10.1.0.0/16");
+
+    PrefixSet copy(set);
+    CHECK(copy == set);
+    CHECK(copy.tlv(0) != set.tlv(0));
+    CHECK_EQ(copy.lookup(addr("10.1.0.1")), set.lookup(addr("10.1.0.1")));
+
+    PrefixSet other(of13::OFPXMT_OFB_IPV4_DST);
+    other.add("10.1.0.0/16");
+    other.add("10.0.0.0/8");
+    // Indexes are part of the set, so order matters
+    CHECK(not (other == set));
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    checkLongestMatch();
+    checkDefaultRoute();
+    checkDuplicates();
+    checkCopy();
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Slab.hh"
+
+#include <set>
+#include <glog/logging.h>
+
+struct Object {
+    uint64_t a;
+    uint64_t b;
+};
+
+static void checkReuse()
+{
+    Slab<Object, 4> slab;
+    void* first = slab.allocate();
+    void* second = slab.allocate();
+    CHECK_EQ(slab.size(), 2u);
+
+    // Freed slots are taken first, the last freed one goes out first
+    slab.free(first);
+    slab.free(second);
+    CHECK_EQ(slab.size(), 0u);
+    CHECK_EQ(slab.allocate(), second);
+    CHECK_EQ(slab.allocate(), first);
+    CHECK_EQ(slab.size(), 2u);
+}
+
+static void checkChunks()
+{
+    Slab<Object, 4> slab;
+    std::set<void*> seen;
+    for (int i = 0; i < 10; ++i)
+        CHECK(seen.insert(slab.allocate()).second);
+    CHECK_EQ(slab.size(), 10u);
+
+    // Churn doesn't grow the slab
+    for (int round = 0; round < 100; ++round) {
+        void* p = *seen.begin();
+        seen.erase(seen.begin());
+        slab.free(p);
+        seen.insert(slab.allocate());
+    }
+    CHECK_EQ(slab.size(), 10u);
+    CHECK_EQ(seen.size(), 10u);
+}
+
+static void checkClear()
+{
+    Slab<Object, 4> slab;
+    slab.free(slab.allocate());
+    slab.clear();
+    CHECK_EQ(slab.size(), 0u);
+    // Free list of the released chunks isn't used
+    slab.allocate();
+    CHECK_EQ(slab.size(), 1u);
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    checkReuse();
+    checkChunks();
+    checkClear();
+    return 0;
+}
@@ -0,0 +1,754 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "TraceTree.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <fluid/util/util.h>
+
+#include "Arena.hh"
+#include "Flow.hh"
+#include "MessageTemplate.hh"
+#include "MicroflowCache.hh"
+#include "Packet.hh"
+#include "PacketInView.hh"
+#include "SendBuffer.hh"
+
+// Flow-mod fields next to the ones patched by MessageTemplate
+static const size_t flowModCommand = 25;
+static const size_t flowModPriority = 30;
+
+// Connection is never dereferenced, writes go to the recorder
+static char connection;
+static OFConnection* const conn = reinterpret_cast<OFConnection*>(&connection);
+
+static uint16_t get16(const uint8_t* msg, size_t offset)
+{
+    uint16_t ret;
+    memcpy(&ret, msg + offset, sizeof(ret));
+    return ntoh16(ret);
+}
+
+static uint32_t get32(const uint8_t* msg, size_t offset)
+{
+    uint32_t ret;
+    memcpy(&ret, msg + offset, sizeof(ret));
+    return ntoh32(ret);
+}
+
+static uint64_t get64(const uint8_t* msg, size_t offset)
+{
+    uint64_t ret;
+    memcpy(&ret, msg + offset, sizeof(ret));
+    return ntoh64(ret);
+}
+
+/// Messages written to switches by the calling thread
+class Sent {
+public:
+    struct Message {
+        uint8_t type;
+        uint32_t xid;
+        // Flow-mods only
+        uint8_t table;
+        uint8_t command;
+        uint16_t priority;
+        uint64_t cookie;
+
+        bool is(uint8_t cmd, uint8_t table_id) const
+        { return type == of13::OFPT_FLOW_MOD && command == cmd && table == table_id; }
+    };
+
+    Sent()
+    {
+        setSendHook([this](OFConnection*, const void* data, size_t len) {
+            record(static_cast<const uint8_t*>(data), len);
+        });
+    }
+
+    ~Sent() { setSendHook(SendHook()); }
+
+    const std::vector<Message>& messages() const { return m_messages; }
+    void clear() { m_messages.clear(); }
+
+    /// Flow-mods with the command, to the table if it's given
+    std::vector<Message> flowMods(uint8_t command, int table = -1) const
+    {
+        std::vector<Message> ret;
+        for (auto& msg : m_messages) {
+            if (msg.type == of13::OFPT_FLOW_MOD && msg.command == command &&
+                    (table < 0 || msg.table == table))
+                ret.push_back(msg);
+        }
+        return ret;
+    }
+
+private:
+    std::vector<Message> m_messages;
+
+    void record(const uint8_t* data, size_t len)
+    {
+        for (size_t offset = 0; offset < len; offset += get16(data + offset, 2)) {
+            const uint8_t* msg = data + offset;
+            Message m = {};
+            m.type = msg[1];
+            m.xid = get32(msg, MessageTemplate::xidOffset);
+            if (m.type == of13::OFPT_FLOW_MOD) {
+                m.table = msg[MessageTemplate::flowModTableId];
+                m.command = msg[flowModCommand];
+                m.priority = get16(msg, flowModPriority);
+                m.cookie = get64(msg, MessageTemplate::flowModCookie);
+            }
+            m_messages.push_back(m);
+        }
+    }
+};
+
+/// Bytes of a frame in network byte order
+class Frame {
+public:
+    Frame& u8(uint8_t v) { m_data.push_back(v); return *this; }
+    Frame& u16(uint16_t v) { return u8(v >> 8).u8(v & 0xff); }
+    Frame& u32(uint32_t v) { return u16(v >> 16).u16(v & 0xffff); }
+    Frame& zero(size_t n) { m_data.insert(m_data.end(), n, 0); return *this; }
+    Frame& bytes(const uint8_t* p, size_t n) { m_data.insert(m_data.end(), p, p + n); return *this; }
+
+    Frame& eth(uint16_t type)
+    {
+        static const uint8_t dst[6] = {0, 0, 0, 0, 0, 2};
+        static const uint8_t src[6] = {0, 0, 0, 0, 0, 1};
+        return bytes(dst, 6).bytes(src, 6).u16(type);
+    }
+
+    const std::vector<uint8_t>& data() const { return m_data; }
+
+private:
+    std::vector<uint8_t> m_data;
+};
+
+static uint32_t ipv4(const char* str)
+{
+    return IPAddress(std::string(str)).getIPv4();
+}
+
+/// Packets of table misses, valid while the check runs
+class Packets {
+public:
+    /// UDP datagram from 10.0.0.1
+    Packet* ipv4(const char* dst, uint32_t in_port = 1, uint16_t udp_dst = 2000)
+    {
+        Frame frame;
+        frame.eth(0x0800)
+             .u8(0x45).u8(0).u16(28).u16(0).u16(0).u8(64).u8(17).u16(0)
+             .u32(::ipv4("10.0.0.1")).u32(::ipv4(dst))
+             .u16(1000).u16(udp_dst).u16(8).u16(0);
+        return make(frame, in_port);
+    }
+
+    /// ARP request from 10.0.0.1
+    Packet* arp(uint32_t in_port = 1)
+    {
+        static const uint8_t sha[6] = {0, 0, 0, 0, 0, 1};
+        Frame frame;
+        frame.eth(0x0806)
+             .u16(1).u16(0x0800).u8(6).u8(4).u16(1)
+             .bytes(sha, 6).u32(::ipv4("10.0.0.1")).zero(6).u32(::ipv4("10.0.0.2"));
+        return make(frame, in_port);
+    }
+
+private:
+    struct Parsed {
+        std::vector<uint8_t> msg;
+        PacketInView view;
+    };
+    std::vector<std::unique_ptr<Parsed>> m_parsed;
+    Arena m_arena;
+
+    Packet* make(const Frame& frame, uint32_t in_port)
+    {
+        // Packet-in with the in_port match padded to 8 bytes
+        Frame msg;
+        size_t length = 42 + frame.data().size();
+        msg.u8(of13::OFP_VERSION).u8(of13::OFPT_PACKET_IN).u16(length).u32(1)
+           .u32(OFP_NO_BUFFER).u16(frame.data().size()).u8(of13::OFPR_NO_MATCH).u8(0)
+           .u32(0).u32(0)
+           .u16(1).u16(12).u32(0x80000004).u32(in_port).zero(4)
+           .zero(2)
+           .bytes(frame.data().data(), frame.data().size());
+
+        m_parsed.emplace_back(new Parsed());
+        Parsed& parsed = *m_parsed.back();
+        parsed.msg = msg.data();
+        CHECK(parsed.view.parse(parsed.msg.data(), parsed.msg.size()));
+        return m_arena.make<Packet>(parsed.view, m_arena);
+    }
+};
+
+/// Flow of a handler decision, owned by the tree once installed
+class TestFlow : public Flow {
+public:
+    explicit TestFlow(Packet* pkt) : Flow(pkt) { }
+
+    /// Adds the leaf of the decision like the controller does
+    TraceTreeNode::LeafData* install(TraceTree& tree)
+    {
+        auto fm = new of13::FlowMod();
+        fm->buffer_id(OFP_NO_BUFFER);
+        fm->command(of13::OFPFC_ADD);
+        initFlowMod(fm);
+        tree.augment(this, fm);
+        setLive();
+        return tree.leaf(fm->cookie());
+    }
+
+    /// Marks the rule installed again like the controller does
+    void reinstalled() { setLive(); }
+
+    /// Outdates the flow like an expired hard timeout
+    void expire()
+    {
+        setDestroy();
+        // Flow is outdated strictly after the destruction time
+        while (not outdated()) { }
+    }
+};
+
+/// IPv4 packets are forwarded by destination, others by the EthType test only
+static TraceTreeNode::LeafData* route(TraceTree& tree, Packet* pkt, uint32_t out_port,
+                                      uint16_t idle_timeout = 0)
+{
+    TestFlow* flow = new TestFlow(pkt);
+    if (flow->match(of13::EthType(0x0800)))
+        flow->loadIPv4Dst();
+    flow->idleTimeout(idle_timeout);
+    flow->add_action(new of13::OutputAction(out_port, 0));
+    return flow->install(tree);
+}
+
+/// Like route(), but only datagrams to unprivileged ports are forwarded by destination
+static TraceTreeNode::LeafData* classify(TraceTree& tree, Packet* pkt, uint32_t out_port)
+{
+    TestFlow* flow = new TestFlow(pkt);
+    if (flow->match(of13::EthType(0x0800)) &&
+            flow->matchRange(of13::UDPDst(1024), of13::UDPDst(65535)))
+        flow->loadIPv4Dst();
+    flow->add_action(new of13::OutputAction(out_port, 0));
+    return flow->install(tree);
+}
+
+static void checkCookieWrap()
+{
+    const uint64_t base = TraceTree::cookieBase;
+    LeafIndex index;
+    CHECK_EQ(index.allocate(base), base | 1);
+    CHECK_EQ(index.allocate(base), base | 2);
+
+    // Cookies never carry into the upper half, zero is skipped
+    index.last = 0xfffffffe;
+    CHECK_EQ(index.allocate(base), base | 0xffffffff);
+    CHECK_EQ(index.allocate(base), base | 1);
+
+    // Cookies of leaves still in the tree aren't given again
+    index.last = 0xffffffff;
+    index.cookies[base | 1] = nullptr;
+    index.cookies[base | 2] = nullptr;
+    CHECK_EQ(index.allocate(base), base | 3);
+}
+
+static void checkIncrementalPriorities()
+{
+    Sent sent;
+    Packets pkts;
+    TraceTree tree;
+
+    // Barrier of the EthType test goes first, then the leaf above it
+    auto first = route(tree, pkts.ipv4("10.0.0.1"), 1);
+    CHECK_EQ(tree.updateFlowTable(conn), 2u);
+    auto adds = sent.flowMods(of13::OFPFC_ADD, TraceTree::firstTable);
+    CHECK_EQ(adds.size(), 2u);
+    CHECK_EQ(adds[0].cookie, TraceTree::cookieBase);
+    CHECK_EQ(adds[1].cookie, first->fm->cookie());
+    uint16_t barrier = adds[0].priority;
+    CHECK_GT(adds[1].priority, barrier);
+
+    // New leaves get rules of their own, installed ones aren't touched
+    sent.clear();
+    auto second = route(tree, pkts.ipv4("10.0.0.2"), 2);
+    CHECK_EQ(tree.updateFlowTable(conn), 1u);
+    adds = sent.flowMods(of13::OFPFC_ADD);
+    CHECK_EQ(adds.size(), 1u);
+    CHECK_EQ(adds[0].cookie, second->fm->cookie());
+    CHECK_GT(adds[0].priority, barrier);
+    CHECK(sent.flowMods(of13::OFPFC_DELETE).empty());
+
+    // Packets failing the test are handled below the barrier
+    sent.clear();
+    auto other = route(tree, pkts.arp(), 3);
+    CHECK_EQ(tree.updateFlowTable(conn), 1u);
+    adds = sent.flowMods(of13::OFPFC_ADD);
+    CHECK_EQ(adds.size(), 1u);
+    CHECK_EQ(adds[0].cookie, other->fm->cookie());
+    CHECK_LT(adds[0].priority, barrier);
+
+    CHECK(not tree.needsUpdate());
+    CHECK_EQ(tree.table(), TraceTree::firstTable);
+    CHECK(tree.find(pkts.ipv4("10.0.0.2")) == second);
+    CHECK(tree.find(pkts.ipv4("10.0.0.3")) == nullptr);
+}
+
+static void checkTableFlip()
+{
+    Sent sent;
+    Packets pkts;
+    TraceTree tree;
+    route(tree, pkts.ipv4("10.0.0.1"), 1);
+    route(tree, pkts.ipv4("10.0.0.2"), 2);
+    tree.updateFlowTable(conn);
+    sent.clear();
+
+    tree.invalidateFlowTable();
+    CHECK(tree.needsUpdate());
+    CHECK_EQ(tree.updateFlowTable(conn), 3u);
+    CHECK(not tree.needsUpdate());
+    CHECK_EQ(tree.table(), TraceTree::secondTable);
+
+    // Standby table is cleaned and filled, and table 0 is redirected
+    // to it after a barrier. Active rules are removed only after that.
+    auto& msgs = sent.messages();
+    CHECK(msgs.front().is(of13::OFPFC_DELETE, TraceTree::secondTable));
+    size_t redirect = 0;
+    while (redirect < msgs.size() && not msgs[redirect].is(of13::OFPFC_ADD, 0))
+        ++redirect;
+    CHECK_LT(redirect, msgs.size());
+    CHECK_EQ(msgs[redirect - 1].type, of13::OFPT_BARRIER_REQUEST);
+    CHECK(msgs.back().is(of13::OFPFC_DELETE, TraceTree::firstTable));
+
+    size_t standby = 0;
+    for (size_t i = 0; i < msgs.size(); ++i) {
+        CHECK(not msgs[i].is(of13::OFPFC_ADD, TraceTree::firstTable));
+        if (msgs[i].is(of13::OFPFC_ADD, TraceTree::secondTable)) {
+            CHECK_LT(i, redirect);
+            ++standby;
+        }
+    }
+    CHECK_EQ(standby, 3u);
+
+    // Leaves added after the flip go to the new active table
+    sent.clear();
+    route(tree, pkts.ipv4("10.0.0.3"), 3);
+    tree.updateFlowTable(conn);
+    CHECK_EQ(sent.flowMods(of13::OFPFC_ADD, TraceTree::secondTable).size(), 1u);
+
+    // And the next rebuild flips back
+    tree.invalidateFlowTable();
+    CHECK_EQ(tree.updateFlowTable(conn), 4u);
+    CHECK_EQ(tree.table(), TraceTree::firstTable);
+}
+
+static void checkCookieIndex()
+{
+    Sent sent;
+    Packets pkts;
+    TraceTree tree;
+    auto a = route(tree, pkts.ipv4("10.0.0.1"), 1);
+    auto b = route(tree, pkts.ipv4("10.0.0.2"), 2);
+    uint64_t cookie_a = a->fm->cookie();
+    uint64_t cookie_b = b->fm->cookie();
+
+    CHECK_NE(cookie_a, cookie_b);
+    CHECK_EQ(cookie_a & TraceTree::cookieMask, TraceTree::cookieBase);
+    CHECK(tree.find(cookie_a) == a->flow);
+    CHECK(tree.leaf(cookie_b) == b);
+    // Barriers share the base cookie, which is never given to leaves
+    CHECK(tree.find(TraceTree::cookieBase) == nullptr);
+
+    // Removals of other rules don't change the occupancy
+    CHECK_EQ(tree.updateFlowTable(conn), 3u);
+    CHECK_EQ(tree.occupancy(), 3u);
+    tree.removed(cookie_a);
+    CHECK_EQ(tree.occupancy(), 2u);
+    tree.removed(TraceTree::cookieBase | 0x1234);
+    CHECK_EQ(tree.occupancy(), 2u);
+
+    // Outdated leaves can't be found by their cookies
+    static_cast<TestFlow*>(b->flow)->expire();
+    CHECK(tree.find(cookie_b) == nullptr);
+    CHECK(tree.find(pkts.ipv4("10.0.0.2")) == nullptr);
+    CHECK(tree.find(cookie_a) == a->flow);
+}
+
+static void checkCompiledTree()
+{
+    Sent sent;
+    Packets pkts;
+    std::vector<Packet*> packets = {
+        pkts.ipv4("10.0.0.1"),
+        pkts.ipv4("10.0.0.2"),
+        pkts.ipv4("10.0.0.1", 1, 53),
+        pkts.arp(),
+        pkts.ipv4("10.0.0.3"),
+    };
+    TraceTree tree;
+    tree.setCompiled(true);
+
+    // Leaves are added while the compiled copy is in use
+    for (size_t i = 0; i + 1 < packets.size(); ++i) {
+        CHECK(tree.find(packets[i]) == nullptr);
+        auto leaf = classify(tree, packets[i], i + 1);
+        CHECK(tree.find(packets[i]) == leaf);
+    }
+    CHECK(tree.find(packets.back()) == nullptr);
+
+    // Compiled copy agrees with the tree itself
+    std::vector<TraceTreeNode::LeafData*> found;
+    for (auto pkt : packets)
+        found.push_back(tree.find(pkt));
+    tree.setCompiled(false);
+    for (size_t i = 0; i < packets.size(); ++i)
+        CHECK(tree.find(packets[i]) == found[i]);
+
+    // Pruned subtrees give their instructions back consistently
+    tree.setCompiled(true);
+    static_cast<TestFlow*>(found[1]->flow)->expire();
+    tree.invalidateFlowTable();
+    tree.updateFlowTable(conn);
+    CHECK(tree.find(packets[1]) == nullptr);
+    CHECK(tree.find(packets[0]) == found[0]);
+    CHECK(tree.find(packets[2]) == found[2]);
+
+    auto again = classify(tree, packets[1], 7);
+    CHECK(tree.find(packets[1]) == again);
+    CHECK(tree.find(packets[3]) == found[3]);
+    tree.quiesce();
+}
+
+static void checkMicroflowCache()
+{
+    Sent sent;
+    Packets pkts;
+    TraceTree tree;
+    MicroflowCache emc(16);
+
+    auto a = route(tree, pkts.ipv4("10.0.0.1"), 1);
+    CHECK(emc.find(tree, pkts.ipv4("10.0.0.1")) == a);
+    // Fields the tree doesn't look at don't make another entry
+    CHECK(emc.find(tree, pkts.ipv4("10.0.0.1", 2, 53)) == a);
+    CHECK(emc.find(tree, pkts.ipv4("10.0.0.2")) == nullptr);
+
+    // Entries of outdated leaves aren't used
+    static_cast<TestFlow*>(a->flow)->expire();
+    CHECK(emc.find(tree, pkts.ipv4("10.0.0.1")) == nullptr);
+    auto b = route(tree, pkts.ipv4("10.0.0.1"), 2);
+    CHECK(emc.find(tree, pkts.ipv4("10.0.0.1")) == b);
+
+    // Cleared tree may give the cookies again, but stale entries never hit
+    tree.clear();
+    auto c = route(tree, pkts.arp(), 3);
+    CHECK(emc.find(tree, pkts.ipv4("10.0.0.1")) == nullptr);
+    CHECK(emc.find(tree, pkts.arp()) == c);
+}
+
+/// Both outcomes of the EthType test lead to the same port
+static TraceTreeNode::LeafData* forward(TraceTree& tree, Packet* pkt, uint32_t out_port,
+                                        uint16_t idle_timeout = 0)
+{
+    TestFlow* flow = new TestFlow(pkt);
+    flow->match(of13::EthType(0x0800));
+    flow->idleTimeout(idle_timeout);
+    flow->add_action(new of13::OutputAction(out_port, 0));
+    return flow->install(tree);
+}
+
+static void checkLeafMerging()
+{
+    Sent sent;
+    Packets pkts;
+    TraceTree tree;
+    tree.setCompression(true);
+    auto ip = forward(tree, pkts.ipv4("10.0.0.1"), 1);
+    auto arp = forward(tree, pkts.arp(), 1);
+
+    // Permanent leaves with the same actions share one rule
+    // without the barrier of the test
+    CHECK_EQ(tree.buildFlowTable(conn), 1u);
+    auto adds = sent.flowMods(of13::OFPFC_ADD);
+    CHECK_EQ(adds.size(), 1u);
+    CHECK(adds[0].cookie == ip->fm->cookie() || adds[0].cookie == arp->fm->cookie());
+
+    // Different actions need rules of their own, but the barrier is
+    // still covered by the permanent rule of the positive branch
+    sent.clear();
+    TraceTree split;
+    split.setCompression(true);
+    forward(split, pkts.ipv4("10.0.0.1"), 1);
+    forward(split, pkts.arp(), 2);
+    CHECK_EQ(split.buildFlowTable(conn), 2u);
+    for (auto& add : sent.flowMods(of13::OFPFC_ADD))
+        CHECK_NE(add.cookie, TraceTree::cookieBase);
+
+    // Leaves that may expire are never merged
+    sent.clear();
+    TraceTree timed;
+    timed.setCompression(true);
+    forward(timed, pkts.ipv4("10.0.0.1"), 1, 10);
+    forward(timed, pkts.arp(), 1, 10);
+    CHECK_EQ(timed.buildFlowTable(conn), 3u);
+
+    // Nor are leaves of trees without compression
+    sent.clear();
+    TraceTree plain;
+    forward(plain, pkts.ipv4("10.0.0.1"), 1);
+    forward(plain, pkts.arp(), 1);
+    CHECK_EQ(plain.buildFlowTable(conn), 3u);
+}
+
+/// Forwards by destination whatever port the packet came from
+static TraceTreeNode::LeafData* switchPacket(TraceTree& tree, Packet* pkt)
+{
+    TestFlow* flow = new TestFlow(pkt);
+    flow->loadInPort();
+    bool first = flow->loadIPv4Dst().getIPv4() == ipv4("10.0.0.1");
+    flow->idleTimeout(10);
+    flow->add_action(new of13::OutputAction(first ? 5 : 6, 0));
+    return flow->install(tree);
+}
+
+static void checkPipelineFactoring()
+{
+    Sent sent;
+    Packets pkts;
+    TraceTree tree;
+    tree.setPipeline(2);
+    std::vector<TraceTreeNode::LeafData*> leaves;
+    for (uint32_t port = 1; port <= 3; ++port) {
+        for (auto dst : {"10.0.0.1", "10.0.0.2"})
+            leaves.push_back(switchPacket(tree, pkts.ipv4(dst, port)));
+    }
+
+    // Branches with equal subtrees jump to the next table, where the
+    // subtree is installed once after the barrier of the table
+    const uint8_t next = TraceTree::firstTable + 2;
+    CHECK(tree.usesTable(next));
+    CHECK_EQ(tree.buildFlowTable(conn), 6u);
+    CHECK_EQ(sent.flowMods(of13::OFPFC_ADD, TraceTree::firstTable).size(), 3u);
+    auto group = sent.flowMods(of13::OFPFC_ADD, next);
+    CHECK_EQ(group.size(), 3u);
+
+    // Shared rules keep the cookies of the leaves that emitted them
+    std::vector<uint64_t> owners;
+    for (auto& add : group) {
+        if (add.cookie != TraceTree::cookieBase)
+            owners.push_back(add.cookie);
+    }
+    CHECK_EQ(owners.size(), 2u);
+
+    auto sharer = *std::find_if(leaves.begin(), leaves.end(), [&](TraceTreeNode::LeafData* l) {
+        return std::count(owners.begin(), owners.end(), l->fm->cookie()) == 0;
+    });
+    sent.clear();
+    auto installed = tree.reinstall(sharer, conn, 0, OFP_NO_BUFFER);
+    CHECK(installed != nullptr);
+    CHECK(installed != sharer);
+    CHECK_EQ(std::count(owners.begin(), owners.end(), installed->fm->cookie()), 1);
+    auto adds = sent.flowMods(of13::OFPFC_ADD);
+    CHECK_EQ(adds.size(), 1u);
+    CHECK_EQ(adds[0].cookie, installed->fm->cookie());
+    CHECK_EQ(adds[0].table, next);
+
+    // Rule of an outdated owner is emitted again by the rebuild
+    static_cast<TestFlow*>(installed->flow)->expire();
+    sent.clear();
+    CHECK(tree.reinstall(sharer, conn, 0, OFP_NO_BUFFER) == nullptr);
+    CHECK(sent.messages().empty());
+    CHECK(tree.needsUpdate());
+
+    // Without the pipeline every branch has rules of its own
+    sent.clear();
+    TraceTree flat;
+    for (uint32_t port = 1; port <= 3; ++port) {
+        for (auto dst : {"10.0.0.1", "10.0.0.2"})
+            switchPacket(flat, pkts.ipv4(dst, port));
+    }
+    CHECK_EQ(flat.buildFlowTable(conn), 6u);
+    CHECK_EQ(sent.flowMods(of13::OFPFC_ADD, TraceTree::firstTable).size(), 6u);
+}
+
+/// Forwards by destination only, rules expire when idle
+static TraceTreeNode::LeafData* host(TraceTree& tree, Packet* pkt, uint32_t out_port)
+{
+    TestFlow* flow = new TestFlow(pkt);
+    flow->loadIPv4Dst();
+    flow->idleTimeout(10);
+    flow->add_action(new of13::OutputAction(out_port, 0));
+    return flow->install(tree);
+}
+
+static std::string hostAddress(unsigned i)
+{
+    return "10.0.1." + std::to_string(i);
+}
+
+static void checkEviction()
+{
+    Sent sent;
+    Packets pkts;
+    TraceTree tree;
+    const unsigned capacity = 10;
+    tree.setCapacity(capacity);
+
+    std::vector<TraceTreeNode::LeafData*> leaves;
+    for (unsigned i = 0; i < capacity; ++i) {
+        leaves.push_back(host(tree, pkts.ipv4(hostAddress(i).c_str()), 1));
+        tree.updateFlowTable(conn);
+    }
+    CHECK_EQ(tree.occupancy(), capacity);
+    CHECK(sent.flowMods(of13::OFPFC_DELETE).empty());
+
+    // Hit leaf becomes the most recent one
+    tree.hit(leaves[0]->fm->cookie(), 5);
+
+    // Rules are deleted by cookie from the least recently hit leaf,
+    // and a barrier keeps the new rule behind the deletions
+    sent.clear();
+    leaves.push_back(host(tree, pkts.ipv4(hostAddress(capacity).c_str()), 1));
+    tree.updateFlowTable(conn);
+    auto deletes = sent.flowMods(of13::OFPFC_DELETE, of13::OFPTT_ALL);
+    CHECK(not deletes.empty());
+    for (size_t i = 0; i < deletes.size(); ++i) {
+        CHECK_EQ(deletes[i].cookie, leaves[i + 1]->fm->cookie());
+        CHECK_EQ(leaves[i + 1]->flow->state(), Flow::Shadowed);
+    }
+    CHECK_EQ(leaves[0]->flow->state(), Flow::Live);
+    CHECK_LE(tree.occupancy(), capacity);
+
+    auto& msgs = sent.messages();
+    CHECK_EQ(msgs[deletes.size()].type, of13::OFPT_BARRIER_REQUEST);
+    CHECK(msgs.back().is(of13::OFPFC_ADD, TraceTree::firstTable));
+    CHECK_EQ(msgs.back().cookie, leaves.back()->fm->cookie());
+
+    // Evicted leaf is reinstalled on the next miss and is the most
+    // recent one again
+    auto evicted = leaves[1];
+    CHECK(tree.reinstall(evicted, conn, 0, OFP_NO_BUFFER) == evicted);
+    static_cast<TestFlow*>(evicted->flow)->reinstalled();
+    CHECK_LE(tree.occupancy(), capacity);
+    sent.clear();
+    for (unsigned i = capacity + 1; tree.occupancy() < capacity; ++i) {
+        leaves.push_back(host(tree, pkts.ipv4(hostAddress(i).c_str()), 1));
+        tree.updateFlowTable(conn);
+    }
+    leaves.push_back(host(tree, pkts.ipv4(hostAddress(100).c_str()), 1));
+    tree.updateFlowTable(conn);
+    for (auto& del : sent.flowMods(of13::OFPFC_DELETE, of13::OFPTT_ALL)) {
+        CHECK_NE(del.cookie, evicted->fm->cookie());
+        CHECK_NE(del.cookie, leaves[0]->fm->cookie());
+    }
+}
+
+static void checkTableFull()
+{
+    Sent sent;
+    Packets pkts;
+    TraceTree tree;
+    for (unsigned i = 0; i < 4; ++i)
+        host(tree, pkts.ipv4(hostAddress(i).c_str()), 1);
+    CHECK_EQ(tree.updateFlowTable(conn), 4u);
+    CHECK_EQ(tree.capacity(), 0u);
+
+    // Refused rule isn't in the table
+    tree.tableFull();
+    CHECK_EQ(tree.occupancy(), 3u);
+    CHECK_EQ(tree.capacity(), 3u);
+
+    // Capacity only shrinks
+    tree.setOccupancy(2);
+    tree.tableFull();
+    CHECK_EQ(tree.capacity(), 1u);
+}
+
+static void checkConcurrentLookups()
+{
+    Sent sent;
+    Packets pkts;
+    TraceTree tree;
+
+    const unsigned readers = 4;
+    std::vector<TraceTreeNode::LeafData*> found;
+    for (unsigned i = 0; i < readers; ++i)
+        found.push_back(route(tree, pkts.ipv4(hostAddress(i).c_str()), i + 1));
+    tree.updateFlowTable(conn);
+
+    // Readers look up their leaves while the tree is changed and rebuilt
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < readers; ++i) {
+        threads.emplace_back([&tree, &stop, &found, i] {
+            Packets own;
+            Packet* pkt = own.ipv4(hostAddress(i).c_str());
+            unsigned lookups = 0;
+            while (not stop || lookups == 0) {
+                CHECK(tree.find(pkt) == found[i]);
+                ++lookups;
+            }
+        });
+    }
+
+    for (unsigned i = readers; i < 200; ++i) {
+        route(tree, pkts.ipv4(hostAddress(i).c_str()), 1);
+        if (i % 10 == 0)
+            tree.invalidateFlowTable();
+        tree.updateFlowTable(conn);
+        tree.quiesce();
+    }
+    stop = true;
+    for (auto& t : threads)
+        t.join();
+
+    // Leaf found before its flow expired stays readable until quiesce()
+    auto leaf = tree.find(pkts.ipv4(hostAddress(readers).c_str()));
+    CHECK(leaf != nullptr);
+    uint64_t cookie = leaf->fm->cookie();
+    static_cast<TestFlow*>(leaf->flow)->expire();
+    tree.invalidateFlowTable();
+    tree.updateFlowTable(conn);
+    CHECK(tree.find(cookie) == nullptr);
+    CHECK_EQ(leaf->fm->cookie(), cookie);
+    tree.quiesce();
+    CHECK(tree.find(pkts.ipv4(hostAddress(readers).c_str())) == nullptr);
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    checkCookieWrap();
+    checkCookieIndex();
+    checkIncrementalPriorities();
+    checkTableFlip();
+    checkCompiledTree();
+    checkMicroflowCache();
+    checkLeafMerging();
+    checkPipelineFactoring();
+    checkEviction();
+    checkTableFull();
+    checkConcurrentLookups();
+    return 0;
+}